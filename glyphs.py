@@ -0,0 +1,361 @@
+#!/usr/bin/env python3
+"""
+Work out the exact set of glyphs each custom font of the watchface can draw.
+
+The glyphs are collected from `trekkie.c` itself: the `texts` and `styles` tables and the
+`set_styled_text` calls say which fonts may draw each text, and each `set_text` (or
+`set_styled_text`) call says what it may show, either a literal, or a buffer filled by `snprintf`
+(whose format strings we expand) or by the formatting functions (whose literals and lookup tables
+we collect), or a value returned by a function or picked from a table of literals. This assumes the
+code follows the patterns it uses today; anything this does not understand is an error rather than
+a guess, so a new pattern can't silently drop glyphs.
+
+Both `wscript` (to generate minimal font resources) and the host build (to verify the traces draw
+nothing else) use this. Run it directly to print the glyph sets and the estimated heap of each font.
+"""
+
+import json
+import os
+import re
+import struct
+import sys
+
+DIGITS = set('0123456789')
+
+# Characters which are laid out (or terminate the text) but need no glyph.
+NO_GLYPH = set('\n\0')
+
+# The functions which show a text rather than write it.
+SHOW_FUNCTIONS = ['set_text', 'set_styled_text']
+
+# The number of entries in the hash table of a Pebble font resource.
+FONT_HASH_TABLE_SIZE = 255
+
+
+class GlyphError(Exception):
+    pass
+
+
+def c_literal(literal):
+    """The characters of a C string or character literal (without the quotes)."""
+    return literal.encode('latin-1').decode('unicode_escape')
+
+
+def split_arguments(arguments):
+    """Split a C argument list on the top-level commas."""
+    parts, depth, start, quote = [], 0, 0, None
+    for index, character in enumerate(arguments):
+        if quote:
+            if character == '\\':
+                continue
+            if character == quote and arguments[index - 1] != '\\':
+                quote = None
+        elif character in '"\'':
+            quote = character
+        elif character in '([{':
+            depth += 1
+        elif character in ')]}':
+            depth -= 1
+        elif character == ',' and depth == 0:
+            parts.append(arguments[start:index].strip())
+            start = index + 1
+    parts.append(arguments[start:].strip())
+    return parts
+
+
+def calls(body, function):
+    """The argument lists of all the calls to the function in the body."""
+    for match in re.finditer(r'\b%s\(' % function, body):
+        depth, index = 1, match.end()
+        while depth:
+            depth += {'(': 1, ')': -1}.get(body[index], 0)
+            index += 1
+        yield split_arguments(body[match.end():index - 1])
+
+
+class Source:
+    """The parts of `trekkie.c` we need to work out the glyphs."""
+
+    def __init__(self, path):
+        with open(path) as file:
+            self.text = re.sub(r'//[^\n]*', '', file.read())
+        with open(path) as file:
+            commented = file.read()
+        # A font may use a different resource on some platforms, so it may draw with any of them.
+        self.fonts = {}
+        # The characters a font draws from its sprites atlas, which it must be able to draw, and
+        # which are all the texts in it may use.
+        self.sprite_characters = {}
+        for resource, sprites, font in re.findall(r'\{ RESOURCE_ID_(\w+)(?:, "((?:[^"\\]|\\.)*)")? \},? '
+                                                  r'// (\w+_FONT)', commented):
+            self.fonts.setdefault(font, set()).add(resource)
+            if sprites:
+                self.sprite_characters[(font, resource)] = set(c_literal(sprites))
+        style_fonts = dict((style, font) for font, style
+                           in re.findall(r'\{ (\w+_FONT), [^\n]*\}, // (\w+_STYLE)', commented))
+        self.functions = {}
+        for match in re.finditer(r'^static [^;{]*?\b(\w+)\([^;{]*\) \{$(.*?)^\}$', self.text, re.M | re.S):
+            self.functions[match.group(1)] = match.group(2)
+        self.text_fonts = {}
+        for style, text in re.findall(r'\{ (\w+_STYLE) \}, // (\w+_TEXT)', commented):
+            self.text_fonts.setdefault(text, set()).add(style_fonts[style])
+        for body in self.functions.values():
+            for arguments in calls(body, 'set_styled_text'):
+                for style in re.findall(r'\w+_STYLE', arguments[1]):
+                    self.text_fonts.setdefault(arguments[0], set()).add(style_fonts[style])
+
+    def font_glyphs(self):
+        """The glyphs each font resource may draw."""
+        glyphs = dict((resource, set()) for resources in self.fonts.values() for resource in resources)
+        for function, body in self.functions.items():
+            for arguments in list(calls(body, 'set_text')) + [[arguments[0], arguments[2]]
+                                                             for arguments in calls(body, 'set_styled_text')]:
+                if arguments[0] == 'which_text':
+                    continue
+                fonts = self.text_fonts.get(arguments[0])
+                if not fonts:
+                    raise GlyphError('%s: unknown text %s' % (function, arguments[0]))
+                for font in fonts:
+                    for resource in self.fonts[font]:
+                        value_glyphs = self.value_glyphs(function, arguments[1])
+                        sprites = self.sprite_characters.get((font, resource))
+                        if sprites is not None and not value_glyphs <= sprites | NO_GLYPH:
+                            raise GlyphError('%s: %s has no sprites for %s' % (
+                                function, font, ''.join(sorted(value_glyphs - sprites - NO_GLYPH))))
+                        glyphs[resource] |= value_glyphs
+        for (font, resource), sprites in self.sprite_characters.items():
+            glyphs[resource] |= sprites
+        for resource in glyphs:
+            glyphs[resource] -= NO_GLYPH
+        return glyphs
+
+    def value_glyphs(self, function, expression):
+        """The glyphs of a (char *) expression in the function."""
+        body = self.functions[function]
+        expression = expression.strip()
+        if expression == 'NULL':
+            return set()
+        if expression.startswith('"'):
+            return set(''.join(c_literal(literal) for literal in re.findall(r'"((?:[^"\\]|\\.)*)"', expression)))
+        match = re.match(r'(\w+)\(.*\)$', expression)
+        if match and match.group(1) in self.functions:
+            returned = set()
+            for value in re.findall(r'\breturn ([^;]+);', self.functions[match.group(1)]):
+                returned |= self.value_glyphs(match.group(1), value.strip())
+            return returned
+        match = re.match(r'(\w+)\[.*\]$', expression)
+        if match:
+            table = re.search(r'\b%s\[\] = \{([^}]*)\}' % match.group(1), body + self.text)
+            if not table:
+                raise GlyphError('%s: unknown table %s' % (function, match.group(1)))
+            return self.value_glyphs(function, table.group(1).replace(',', ''))
+        if not re.match(r'\w+$', expression):
+            raise GlyphError('%s: can not work out the glyphs of %s' % (function, expression))
+        return self.buffer_glyphs(function, expression)
+
+    def buffer_glyphs(self, function, name):
+        """The glyphs of a text variable in the function, from whatever writes or assigns to it."""
+        body = self.functions[function]
+        glyphs = set()
+        is_written = False
+        for arguments in calls(body, 'snprintf'):
+            if arguments[0] == name:
+                is_written = True
+                glyphs |= self.format_glyphs(function, arguments[2], arguments[3:])
+        for writer in self.functions:
+            if writer in SHOW_FUNCTIONS:
+                continue
+            for arguments in calls(body, writer):
+                if arguments[0] == name:
+                    is_written = True
+                    glyphs |= self.writer_glyphs(writer, set())
+        for value in re.findall(r'(?<![\w.>])%s = ([^;]+);' % name, body):
+            if not value.startswith('"') or not is_written:
+                is_written = True
+                glyphs |= self.value_glyphs(function, value.strip())
+        if not is_written:
+            raise GlyphError('%s: can not work out what is written to %s' % (function, name))
+        return glyphs
+
+    def writer_glyphs(self, function, visited):
+        """
+        The glyphs a function may write into a text: its literals, the literals of the constant
+        tables it uses, and whatever the functions it calls may write.
+        """
+        visited.add(function)
+        body = self.functions[function]
+        glyphs = set(c_literal(literal) for literal in re.findall(r"'((?:[^'\\]|\\.)*)'", body))
+        for literal in re.findall(r'"((?:[^"\\]|\\.)*)"', body):
+            glyphs |= set(c_literal(literal))
+        for name in set(re.findall(r'\b(\w+)\b', body)):
+            table = re.search(r'^static const char %s\[\] =\s*((?:"(?:[^"\\]|\\.)*"\s*)+);' % name, self.text, re.M)
+            if table:
+                glyphs |= self.value_glyphs(function, table.group(1))
+            elif name in self.functions and name not in visited:
+                glyphs |= self.writer_glyphs(name, visited)
+        return glyphs
+
+    def format_glyphs(self, function, format_literal, arguments):
+        """The glyphs `snprintf` may produce for the format and arguments."""
+        glyphs = set()
+        text = self.value_glyphs(function, format_literal) and c_literal(format_literal.strip('"'))
+        parts = re.split(r'(%[-0-9]*[a-z%])', text)
+        arguments = list(arguments)
+        for part in parts:
+            if not part.startswith('%'):
+                glyphs |= set(part)
+            elif part == '%%':
+                glyphs.add('%')
+            elif part.endswith('d'):
+                # All the numbers we show are non-negative.
+                arguments.pop(0)
+                glyphs |= DIGITS
+            elif part.endswith('c'):
+                glyphs |= self.char_glyphs(function, arguments.pop(0))
+            elif part.endswith('s'):
+                glyphs |= self.value_glyphs(function, arguments.pop(0))
+            else:
+                raise GlyphError('%s: unknown conversion %s' % (function, part))
+        return glyphs
+
+    def char_glyphs(self, function, expression):
+        """The glyphs of a (char) expression: the character literals assigned to it."""
+        body = self.functions[function]
+        values = re.findall(r"'((?:[^'\\]|\\.)*)'", expression)
+        if re.match(r'\w+$', expression):
+            for value in re.findall(r'(?<![\w.>])%s = ([^;]+);' % expression, body):
+                values += re.findall(r"'((?:[^'\\]|\\.)*)'", value)
+        if not values:
+            raise GlyphError('%s: can not work out the characters of %s' % (function, expression))
+        return set(c_literal(value) for value in values)
+
+
+def character_regex(glyphs):
+    """A character class matching exactly the glyphs, as `characterRegex` expects."""
+    escaped = ''.join(('\\' + glyph) if glyph in '\\]^-' else glyph for glyph in sorted(glyphs))
+    return '[%s]' % escaped
+
+
+class TrueTypeFont:
+    """Just enough of a TrueType font file to tell which glyphs it has and how large they are."""
+
+    def __init__(self, path):
+        with open(path, 'rb') as file:
+            self.data = file.read()
+        tables_count, = struct.unpack('>H', self.data[4:6])
+        self.tables = {}
+        for index in range(tables_count):
+            tag, _, offset, _ = struct.unpack('>4sIII', self.data[12 + 16 * index:28 + 16 * index])
+            self.tables[tag.decode('latin-1')] = offset
+        head = self.tables['head']
+        self.units_per_em, = struct.unpack('>H', self.data[head + 18:head + 20])
+        self.long_locations, = struct.unpack('>h', self.data[head + 50:head + 52])
+        self.glyph_indices = self.read_cmap()
+
+    def read_cmap(self):
+        """Map each character of the Unicode BMP (format 4) subtable to its glyph index."""
+        cmap = self.tables['cmap']
+        subtables_count, = struct.unpack('>H', self.data[cmap + 2:cmap + 4])
+        for index in range(subtables_count):
+            platform, encoding, offset = struct.unpack('>HHI', self.data[cmap + 4 + 8 * index:cmap + 12 + 8 * index])
+            subtable = cmap + offset
+            if (platform, encoding) == (3, 1) and struct.unpack('>H', self.data[subtable:subtable + 2])[0] == 4:
+                break
+        else:
+            raise GlyphError('no Unicode BMP cmap subtable')
+        segments_count = struct.unpack('>H', self.data[subtable + 6:subtable + 8])[0] // 2
+        def array(index):
+            start = subtable + 14 + index * 2 * segments_count + (2 if index else 0)
+            return struct.unpack('>%dH' % segments_count, self.data[start:start + 2 * segments_count])
+        ends, starts, deltas = array(0), array(1), array(2)
+        range_offsets_start = subtable + 16 + 6 * segments_count
+        range_offsets = struct.unpack('>%dH' % segments_count,
+                                      self.data[range_offsets_start:range_offsets_start + 2 * segments_count])
+        indices = {}
+        for segment in range(segments_count):
+            for code in range(starts[segment], min(ends[segment], 0xFFFE) + 1):
+                if range_offsets[segment]:
+                    address = range_offsets_start + 2 * segment + range_offsets[segment] + 2 * (code - starts[segment])
+                    index, = struct.unpack('>H', self.data[address:address + 2])
+                    if index:
+                        index = (index + deltas[segment]) & 0xFFFF
+                else:
+                    index = (code + deltas[segment]) & 0xFFFF
+                if index:
+                    indices[chr(code)] = index
+        return indices
+
+    def bounds(self, glyph):
+        """The bounding box (x_min, y_min, x_max, y_max) of the glyph in font units, or None if empty."""
+        loca = self.tables['loca']
+        index = self.glyph_indices[glyph]
+        if self.long_locations:
+            start, end = struct.unpack('>II', self.data[loca + 4 * index:loca + 4 * index + 8])
+        else:
+            start, end = (2 * value for value in struct.unpack('>HH', self.data[loca + 2 * index:loca + 2 * index + 4]))
+        if start == end:
+            return None
+        glyf = self.tables['glyf'] + start
+        return struct.unpack('>4h', self.data[glyf + 2:glyf + 10])
+
+    def resource_bytes(self, glyphs, pixel_size):
+        """
+        Estimate the size of a Pebble font resource holding the glyphs at the pixel size, which is what
+        loading it takes from the heap. Each glyph has a 5 bytes header and a 1 bit per pixel bitmap, 4
+        byte aligned, and is found through a fixed hash table and a 4 bytes offset table entry.
+        """
+        size = 10 + 4 * FONT_HASH_TABLE_SIZE + 4
+        for glyph in glyphs:
+            bounds = self.bounds(glyph)
+            bitmap_bits = 0
+            if bounds:
+                width = -(-(bounds[2] - bounds[0]) * pixel_size // self.units_per_em)
+                height = -(-(bounds[3] - bounds[1]) * pixel_size // self.units_per_em)
+                bitmap_bits = width * height
+            size += 4 + (5 + (bitmap_bits + 7) // 8 + 3) // 4 * 4
+        return size
+
+
+def font_resources(package_json):
+    """The font resource entries of the package, by name."""
+    with open(package_json) as file:
+        media = json.load(file)['pebble']['resources']['media']
+    return dict((resource['name'], resource) for resource in media if resource['type'] == 'font')
+
+
+def pixel_size(resource_name):
+    """Like the SDK, the pixel size of a font is the number at the end of its resource name."""
+    return int(re.search(r'(\d+)$', resource_name).group(1))
+
+
+def verify_fonts(root):
+    """
+    Work out the glyphs of each font resource, and verify its font file has all of them. Returns a
+    list of (resource name, glyphs, estimated heap bytes).
+    """
+    glyphs = Source(os.path.join(root, 'src', 'c', 'trekkie.c')).font_glyphs()
+    resources = font_resources(os.path.join(root, 'package.json'))
+    fonts = []
+    for name in sorted(glyphs):
+        if name not in resources:
+            raise GlyphError('%s is not a font resource in package.json' % name)
+        font = TrueTypeFont(os.path.join(root, 'resources', resources[name]['file']))
+        missing = sorted(glyph for glyph in glyphs[name] if glyph not in font.glyph_indices)
+        if missing:
+            raise GlyphError('%s does not have the glyphs %s' % (resources[name]['file'], ''.join(missing)))
+        fonts.append((name, glyphs[name], font.resource_bytes(glyphs[name], pixel_size(name))))
+    return fonts
+
+
+def main(root='.'):
+    try:
+        fonts = verify_fonts(root)
+    except GlyphError as error:
+        sys.stderr.write('glyphs.py: %s\n' % error)
+        sys.exit(1)
+    for name, glyphs, heap_bytes in fonts:
+        print('%-16s %5d bytes %3d glyphs %s' % (name, heap_bytes, len(glyphs), character_regex(glyphs)))
+
+
+if __name__ == '__main__':
+    main(*sys.argv[1:])
@@ -0,0 +1,387 @@
+// Measure how well each time left predictor (see predictors.h) does on recorded battery traces.
+//
+// Usage: accuracy [--step SECONDS] TRACE...
+//
+// The truth is only known for the parts of a trace that end in a known state: a discharge from
+// unplugging (or the trace start) until the first (non-spurious) 0% reading, and a charge until
+// the first 100% reading. Every step (a minute by default) of these, each predictor is asked how
+// long is left, and compared with the actual time until the end of the part.
+//
+// For each trace and predictor, and for discharges and charges separately, the report lists how
+// many times it was asked, how much of the time it had no prediction, the mean, median and 90th
+// percentile of the absolute error and the mean (signed) error, all in hours. It then lists how
+// long it took to converge after each plug or unplug, that is, until the error stays within 10% of
+// the length of the part (or half an hour; missing predictions do not count as errors), and how
+// many times it never did. Finally it lists how long each
+// battery event update and each prediction take on this host. The corpus totals follow the traces.
+//
+// Each predictor runs over each trace in a forked child process, with empty persistent storage,
+// so it starts with pristine static variables.
+//
+// The watchface predictor (the first one) must do at least as well as every baseline: if its mean
+// error over all the traces is larger than that of any of them, for discharges or for charges, the
+// regression is reported and the exit status is 1.
+
+#define _GNU_SOURCE
+
+#include "host.h"
+#include "predictors.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+//// Truth.
+
+// The kinds of trace parts we know the truth of.
+typedef enum {
+  DISCHARGE_PART, // From unplugging until the first non-spurious 0% reading.
+  CHARGE_PART, // From starting to charge until the first 100% reading.
+  PARTS_COUNT
+} WhichPart;
+
+static const char *part_names[PARTS_COUNT] = {
+  "discharge",
+  "charge",
+};
+
+// A part of a trace with a known end.
+typedef struct {
+  WhichPart which_part;
+
+  // Whether the part starts with plugging or unplugging the charger (rather than the trace start).
+  bool is_after_change;
+
+  // When the part starts and ends.
+  int64_t start_ms;
+  int64_t end_ms;
+} Part;
+
+// A 0% reading followed by a higher one within this time is spurious (see record_battery_history).
+#define SPURIOUS_MS (60 * 1000)
+
+static bool is_spurious_empty(const HostTrace *trace, size_t index) {
+  for (size_t next = index + 1; next < trace->events_count; ++next) {
+    const HostEvent *event = &trace->events[next];
+    if (event->time_ms - trace->events[index].time_ms >= SPURIOUS_MS) {
+      return false;
+    }
+    if (event->kind == EVENT_BATTERY) {
+      return event->battery.charge_percent > 0;
+    }
+  }
+  return false;
+}
+
+// Find the parts of the trace with a known end; return how many there are.
+static size_t find_parts(const HostTrace *trace, Part **parts) {
+  size_t count = 0;
+  *parts = malloc(trace->events_count * sizeof(Part));
+  BatteryChargeState battery = trace->battery;
+  Part part = { .which_part = battery.is_charging ? CHARGE_PART : DISCHARGE_PART, .start_ms = trace->start_ms };
+  bool is_open = battery.is_charging || !battery.is_plugged;
+  for (size_t index = 0; index < trace->events_count; ++index) {
+    const HostEvent *event = &trace->events[index];
+    if (event->kind != EVENT_BATTERY) {
+      continue;
+    }
+    // A charge ends with the 100% reading, which also says it is no longer charging.
+    if (is_open
+     && (part.which_part == DISCHARGE_PART
+         ? event->battery.charge_percent == 0 && !is_spurious_empty(trace, index)
+         : event->battery.charge_percent == 100)) {
+      part.end_ms = event->time_ms;
+      (*parts)[count++] = part;
+      is_open = false;
+    }
+    if (event->battery.is_charging != battery.is_charging || event->battery.is_plugged != battery.is_plugged) {
+      part = (Part){ .which_part = event->battery.is_charging ? CHARGE_PART : DISCHARGE_PART,
+                     .is_after_change = true, .start_ms = event->time_ms };
+      is_open = event->battery.is_charging || !event->battery.is_plugged;
+    }
+    battery = event->battery;
+  }
+  return count;
+}
+
+//// Accuracy.
+
+// The resolution of the absolute error histogram (used for the percentiles).
+#define ERROR_BUCKET_SECONDS 360
+
+// The largest error the histogram tracks; larger errors are counted in the last bucket.
+#define ERROR_BUCKETS_COUNT (14 * 86400 / ERROR_BUCKET_SECONDS)
+
+// An error within this fraction of the part length (or the minimal seconds) counts as converged.
+#define CONVERGED_FRACTION 0.1
+#define CONVERGED_MINIMAL_SECONDS 1800
+
+// The accuracy of a predictor over one kind of parts.
+typedef struct {
+  // How many times it was asked, and how many of these it had no prediction.
+  uint64_t samples;
+  uint64_t missing_samples;
+
+  // The sums of the absolute and signed errors (positive means it predicted too long).
+  double absolute_error_seconds;
+  double error_seconds;
+
+  // How many times the absolute error fell in each bucket.
+  uint32_t error_buckets[ERROR_BUCKETS_COUNT];
+
+  // How many parts started with a change of the charger, how many of these converged, and the
+  // total time it took them.
+  int changes;
+  int converged_changes;
+  double converge_seconds;
+
+  // How many battery updates and predictions it did, and how long they took on this host.
+  uint64_t updates;
+  uint64_t update_nanoseconds;
+  uint64_t predictions;
+  uint64_t predict_nanoseconds;
+} Accuracy;
+
+static void add_accuracy(Accuracy *total, const Accuracy *accuracy) {
+  total->samples += accuracy->samples;
+  total->missing_samples += accuracy->missing_samples;
+  total->absolute_error_seconds += accuracy->absolute_error_seconds;
+  total->error_seconds += accuracy->error_seconds;
+  for (int bucket = 0; bucket < ERROR_BUCKETS_COUNT; ++bucket) {
+    total->error_buckets[bucket] += accuracy->error_buckets[bucket];
+  }
+  total->changes += accuracy->changes;
+  total->converged_changes += accuracy->converged_changes;
+  total->converge_seconds += accuracy->converge_seconds;
+  total->updates += accuracy->updates;
+  total->update_nanoseconds += accuracy->update_nanoseconds;
+  total->predictions += accuracy->predictions;
+  total->predict_nanoseconds += accuracy->predict_nanoseconds;
+}
+
+// The absolute error in hours below which the given fraction of the predictions fall.
+static double error_percentile(const Accuracy *accuracy, double fraction) {
+  uint64_t predicted = accuracy->samples - accuracy->missing_samples;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < ERROR_BUCKETS_COUNT; ++bucket) {
+    seen += accuracy->error_buckets[bucket];
+    if (seen && seen >= fraction * predicted) {
+      return (bucket + 0.5) * ERROR_BUCKET_SECONDS / 3600.0;
+    }
+  }
+  return 0;
+}
+
+static uint64_t nanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//// Evaluate.
+
+// Run the predictor over the trace, asking it for a prediction every step inside the parts.
+static void evaluate(const HostPredictor *predictor, const HostTrace *trace, const Part *parts, size_t parts_count,
+                     int step_seconds, Accuracy accuracies[PARTS_COUNT]) {
+  memset(host, 0, sizeof(*host));
+  host->now_ms = trace->start_ms;
+  host->battery = trace->battery;
+  host->is_bluetooth_connected = trace->is_bluetooth_connected;
+  host->is_24h_style = trace->is_24h_style;
+  predictor->init(trace->battery, trace->is_bluetooth_connected);
+  predictor->battery(trace->start_ms / 1000, trace->battery);
+
+  const Part *part = parts;
+  // The first time since the prediction was last wrong in the current part that it was right, or 0.
+  int64_t converged_ms = 0;
+  size_t next_event = 0;
+  int64_t end_ms = trace->events[trace->events_count - 1].time_ms;
+  for (int64_t now_ms = trace->start_ms; now_ms <= end_ms; now_ms += step_seconds * 1000) {
+    for (; next_event < trace->events_count && trace->events[next_event].time_ms <= now_ms; ++next_event) {
+      const HostEvent *event = &trace->events[next_event];
+      host->now_ms = event->time_ms;
+      if (event->kind == EVENT_BATTERY) {
+        host->battery = event->battery;
+        Accuracy *accuracy = &accuracies[event->battery.is_charging ? CHARGE_PART : DISCHARGE_PART];
+        uint64_t start = nanoseconds();
+        predictor->battery(event->time_ms / 1000, event->battery);
+        accuracy->update_nanoseconds += nanoseconds() - start;
+        ++accuracy->updates;
+      } else if (event->kind == EVENT_BLUETOOTH && predictor->bluetooth) {
+        host->is_bluetooth_connected = event->is_connected;
+        predictor->bluetooth(event->time_ms / 1000, event->is_connected);
+      }
+    }
+    host->now_ms = now_ms;
+
+    while (part < parts + parts_count && part->end_ms <= now_ms) {
+      Accuracy *accuracy = &accuracies[part->which_part];
+      if (part->is_after_change) {
+        ++accuracy->changes;
+        if (converged_ms) {
+          ++accuracy->converged_changes;
+          accuracy->converge_seconds += (converged_ms - part->start_ms) / 1000.0;
+        }
+      }
+      ++part;
+      converged_ms = 0;
+    }
+    if (part == parts + parts_count || now_ms <= part->start_ms) {
+      continue;
+    }
+
+    Accuracy *accuracy = &accuracies[part->which_part];
+    uint64_t start = nanoseconds();
+    int32_t predicted_seconds = predictor->predict(now_ms / 1000);
+    accuracy->predict_nanoseconds += nanoseconds() - start;
+    ++accuracy->predictions;
+    ++accuracy->samples;
+    double actual_seconds = (part->end_ms - now_ms) / 1000.0;
+    if (predicted_seconds < 0) {
+      ++accuracy->missing_samples;
+      continue;
+    }
+    double error_seconds = predicted_seconds - actual_seconds;
+    double absolute_error_seconds = error_seconds < 0 ? -error_seconds : error_seconds;
+    accuracy->error_seconds += error_seconds;
+    accuracy->absolute_error_seconds += absolute_error_seconds;
+    int bucket = absolute_error_seconds / ERROR_BUCKET_SECONDS;
+    ++accuracy->error_buckets[bucket < ERROR_BUCKETS_COUNT ? bucket : ERROR_BUCKETS_COUNT - 1];
+    double part_seconds = (part->end_ms - part->start_ms) / 1000.0;
+    if (absolute_error_seconds > CONVERGED_FRACTION * part_seconds
+     && absolute_error_seconds > CONVERGED_MINIMAL_SECONDS) {
+      converged_ms = 0;
+    } else if (!converged_ms) {
+      converged_ms = now_ms;
+    }
+  }
+}
+
+//// Report.
+
+static void print_header(void) {
+  printf("%-16s %-9s %8s %6s %7s %7s %7s %7s %7s %6s %9s %9s\n", "predictor", "part", "samples", "none%",
+         "mean-h", "p50-h", "p90-h", "bias-h", "conv-h", "never", "update-ns", "predict-ns");
+}
+
+// The mean absolute error in hours.
+static double mean_error(const Accuracy *accuracy) {
+  uint64_t predicted = accuracy->samples - accuracy->missing_samples;
+  return predicted ? accuracy->absolute_error_seconds / (predicted * 3600.0) : 0;
+}
+
+static void print_row(const char *name, WhichPart which_part, const Accuracy *accuracy) {
+  if (!accuracy->samples) {
+    return;
+  }
+  uint64_t predicted = accuracy->samples - accuracy->missing_samples;
+  double divisor = predicted ? predicted * 3600.0 : 1;
+  printf("%-16s %-9s %8llu %6.1f %7.1f %7.1f %7.1f %7.1f", name, part_names[which_part],
+         (unsigned long long)accuracy->samples, 100.0 * accuracy->missing_samples / accuracy->samples,
+         mean_error(accuracy), error_percentile(accuracy, 0.5),
+         error_percentile(accuracy, 0.9), accuracy->error_seconds / divisor);
+  if (accuracy->converged_changes) {
+    printf(" %7.1f", accuracy->converge_seconds / accuracy->converged_changes / 3600.0);
+  } else {
+    printf(" %7s", "-");
+  }
+  printf(" %6d %9.0f %9.0f\n", accuracy->changes - accuracy->converged_changes,
+         accuracy->updates ? (double)accuracy->update_nanoseconds / accuracy->updates : 0.0,
+         accuracy->predictions ? (double)accuracy->predict_nanoseconds / accuracy->predictions : 0.0);
+}
+
+// Report every baseline whose corpus mean error beats the watchface; return whether there is none.
+static bool check_regressions(Accuracy (*totals)[PARTS_COUNT]) {
+  bool is_best = true;
+  for (WhichPart which_part = 0; which_part < PARTS_COUNT; ++which_part) {
+    const Accuracy *watchface = &totals[0][which_part];
+    for (int which_predictor = 1; which_predictor < host_predictors_count; ++which_predictor) {
+      const Accuracy *baseline = &totals[which_predictor][which_part];
+      if (baseline->samples && mean_error(baseline) < mean_error(watchface)) {
+        fprintf(stderr, "regression: %s %s mean error is %.1fh, worse than the %.1fh of %s\n",
+                host_predictors[0].name, part_names[which_part], mean_error(watchface),
+                mean_error(baseline), host_predictors[which_predictor].name);
+        is_best = false;
+      }
+    }
+  }
+  return is_best;
+}
+
+//// Main.
+
+int main(int argc, char **argv) {
+  // All the traces are in UTC so the results do not depend on the host.
+  setenv("TZ", "UTC0", 1);
+  tzset();
+  host_setup();
+
+  int step_seconds = 60;
+  int arg = 1;
+  if (arg + 1 < argc && !strcmp(argv[arg], "--step")) {
+    step_seconds = atoi(argv[arg + 1]);
+    arg += 2;
+  }
+  if (arg == argc || step_seconds <= 0) {
+    fprintf(stderr, "usage: %s [--step SECONDS] TRACE...\n", argv[0]);
+    return 2;
+  }
+
+  // The corpus totals of each predictor, accumulated by the child processes.
+  Accuracy (*totals)[PARTS_COUNT] = mmap(NULL, host_predictors_count * sizeof(*totals), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (totals == MAP_FAILED) {
+    perror("mmap");
+    return 2;
+  }
+
+  for (; arg < argc; ++arg) {
+    HostTrace trace = host_load_trace(argv[arg]);
+    Part *parts;
+    size_t parts_count = find_parts(&trace, &parts);
+    int counts[PARTS_COUNT] = { 0 };
+    for (size_t index = 0; index < parts_count; ++index) {
+      ++counts[parts[index].which_part];
+    }
+    printf("== %s: %d discharges and %d charges with a known end\n", trace.path, counts[DISCHARGE_PART],
+           counts[CHARGE_PART]);
+    print_header();
+    for (int which_predictor = 0; which_predictor < host_predictors_count; ++which_predictor) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid < 0) {
+        perror("fork");
+        return 2;
+      }
+      if (!pid) {
+        const HostPredictor *predictor = &host_predictors[which_predictor];
+        static Accuracy accuracies[PARTS_COUNT];
+        evaluate(predictor, &trace, parts, parts_count, step_seconds, accuracies);
+        for (WhichPart which_part = 0; which_part < PARTS_COUNT; ++which_part) {
+          print_row(predictor->name, which_part, &accuracies[which_part]);
+          add_accuracy(&totals[which_predictor][which_part], &accuracies[which_part]);
+        }
+        fflush(stdout);
+        _exit(0);
+      }
+      int status;
+      if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: %s failed\n", trace.path, host_predictors[which_predictor].name);
+        return 2;
+      }
+    }
+    printf("\n");
+    free(parts);
+    free(trace.events);
+  }
+
+  printf("== all traces\n");
+  print_header();
+  for (int which_predictor = 0; which_predictor < host_predictors_count; ++which_predictor) {
+    for (WhichPart which_part = 0; which_part < PARTS_COUNT; ++which_part) {
+      print_row(host_predictors[which_predictor].name, which_part, &totals[which_predictor][which_part]);
+    }
+  }
+  fflush(stdout);
+  return check_regressions(totals) ? 0 : 1;
+}
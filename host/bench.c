@@ -0,0 +1,378 @@
+// Replay recorded event traces into the watchface and report what it costs.
+//
+// Usage: bench [--log] [--png DIR] [--golden DIR] [--budget FILE]... [--static-bytes N]
+//              [--telemetry FILE] TRACE...
+//
+// Each trace is replayed from scratch (empty persistent storage). The watchface is launched in a
+// forked child process, which runs until the trace ends or asks for a restart or a crash; then it
+// is launched again from the same point, with the persistent storage it left behind.
+//
+// The report lists, for each kind of handler, how many times it ran, how long it took on this host,
+// and how many times it performed each of the counted operations. It then normalizes the totals per
+// simulated day, per rendered frame, and the minute ticks per tick (the steady state). If budget
+// files are given, exceeding any of their per-minute-tick limits, their per-simulated-minute limits
+// of the other handlers (or their heap limit) fails the run; so does a heap that doesn't fit in the
+// app memory besides the given bytes of code and static data (as counted by sizes.py; without them,
+// only the heap limit is checked). If a PNG directory is given, the final frame of each trace is
+// written into it as a PNG file named after the trace; if a golden directory is given, the final
+// frame of each trace must be exactly the PNG file named after the trace there (as written by
+// --png), or the run fails.
+
+#define _GNU_SOURCE
+
+#include "host.h"
+
+#include <errno.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// The main of the watchface, renamed in its object file (see the Makefile).
+int trekkie_main(void);
+
+//// Names.
+
+static const char *op_names[OPS_COUNT] = {
+  "graphics_draw_text",
+  "set_text_suppressed",
+  "layer_mark_dirty",
+  "layer_set_hidden",
+  "persist_exists",
+  "persist_read",
+  "persist_write",
+  "snprintf",
+  "strftime",
+  "data_logging_log",
+  "telemetry_dropped",
+  "events_queued",
+  "saved_event_frames",
+  "frames",
+  "pixels",
+  "fills",
+  "blits",
+};
+
+// Short column headers for the above.
+static const char *op_headers[OPS_COUNT] = {
+  "texts",
+  "skipped",
+  "dirty",
+  "hidden",
+  "p_exist",
+  "p_read",
+  "p_write",
+  "snprintf",
+  "strftime",
+  "dlog",
+  "dropped",
+  "events",
+  "saved",
+  "frames",
+  "pixels",
+  "fills",
+  "blits",
+};
+
+static const char *handler_names[HANDLERS_COUNT] = {
+  "init",
+  "second_tick",
+  "minute_tick",
+  "day_tick",
+  "battery",
+  "bluetooth",
+  "compass",
+  "tap",
+  "health",
+  "timer",
+  "focus",
+  "peek",
+  "deinit",
+};
+
+//// Replay.
+
+static void replay(const HostTrace *trace, bool is_logging, const char *telemetry_path, size_t static_bytes) {
+  memset(host, 0, sizeof(*host));
+  host->static_bytes = static_bytes;
+  if (telemetry_path) {
+    snprintf(host->data_logging_path, sizeof(host->data_logging_path), "%s", telemetry_path);
+  }
+  host->now_ms = trace->start_ms;
+  host->events = trace->events;
+  host->events_count = trace->events_count;
+  host->battery = trace->battery;
+  host->is_bluetooth_connected = trace->is_bluetooth_connected;
+  host->is_24h_style = trace->is_24h_style;
+  host->is_logging = is_logging;
+
+  while (!host->is_finished) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(2);
+    }
+    if (!pid) {
+      host_launch(trekkie_main);
+      fflush(stdout);
+      _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+      fprintf(stderr, "%s: watchface launch failed\n", trace->path);
+      exit(2);
+    }
+  }
+}
+
+//// Report.
+
+static void print_header(void) {
+  printf("%-14s %9s %9s %9s", "", "calls", "us/call", "render-us");
+  for (HostOp op = 0; op < OPS_COUNT; ++op) {
+    printf(" %9s", op_headers[op]);
+  }
+  printf("\n");
+}
+
+// Print a row of statistics, divided by the given amount.
+static void print_row(const char *name, const HostStats *stats, double divisor) {
+  double calls = stats->calls ? stats->calls : 1;
+  printf("%-14s %9.2f %9.2f %9.2f", name, stats->calls / divisor, stats->nanoseconds / calls / 1000.0,
+         stats->render_nanoseconds / calls / 1000.0);
+  for (HostOp op = 0; op < OPS_COUNT; ++op) {
+    printf(" %9.2f", stats->ops[op] / divisor);
+  }
+  printf("\n");
+}
+
+static void report(const HostTrace *trace) {
+  double days = (host->now_ms - trace->start_ms) / (86400.0 * 1000.0);
+  printf("== %s: %.2f simulated days, %d launches, first frame after %.2f us, compass on %.2f%% of the time, "
+         "heap at most %zu bytes\n",
+         trace->path, days, host->launches,
+         host->launches ? host->first_frame_nanoseconds / 1000.0 / host->launches : 0.0,
+         days > 0 ? host->compass_on_ms / (864.0 * 1000.0) / days : 0.0, host->heap_high_water);
+  print_header();
+  HostStats total = { 0 };
+  for (HostHandler handler = 0; handler < HANDLERS_COUNT; ++handler) {
+    const HostStats *stats = &host->stats[handler];
+    if (!stats->calls) {
+      continue;
+    }
+    print_row(handler_names[handler], stats, 1);
+    total.calls += stats->calls;
+    total.nanoseconds += stats->nanoseconds;
+    total.render_nanoseconds += stats->render_nanoseconds;
+    for (HostOp op = 0; op < OPS_COUNT; ++op) {
+      total.ops[op] += stats->ops[op];
+    }
+  }
+  print_row("total", &total, 1);
+  if (days > 0) {
+    print_row("per day", &total, days);
+  }
+  if (total.ops[OP_FRAMES]) {
+    print_row("per frame", &total, total.ops[OP_FRAMES]);
+  }
+  const HostStats *minute = &host->stats[HANDLER_MINUTE_TICK];
+  if (minute->calls) {
+    print_row("per minute", minute, minute->calls);
+  }
+  printf("\n");
+}
+
+//// Final frame.
+
+// The PNG file in the directory named after the trace.
+static void frame_path(char *path, size_t size, const char *directory, const HostTrace *trace) {
+  const char *name = strrchr(trace->path, '/') ? strrchr(trace->path, '/') + 1 : trace->path;
+  snprintf(path, size, "%s/%.*s.png", directory, (int)strcspn(name, "."), name);
+}
+
+static void write_final_frame(const char *directory, const HostTrace *trace) {
+  char path[1024];
+  frame_path(path, sizeof(path), directory, trace);
+  host_write_framebuffer(path);
+}
+
+// Compare the final frame with the golden one of the trace; return whether they are the same.
+static bool check_golden_frame(const char *directory, const HostTrace *trace) {
+  char path[1024];
+  frame_path(path, sizeof(path), directory, trace);
+  GRect difference;
+  int differences = host_compare_framebuffer(path, &difference);
+  if (differences < 0) {
+    fprintf(stderr, "%s: can't read the golden frame %s\n", trace->path, path);
+    return false;
+  }
+  if (differences) {
+    fprintf(stderr, "%s: %d pixels differ from %s, within x %d..%d, y %d..%d\n", trace->path,
+            differences, path, difference.origin.x, difference.origin.x + difference.size.w - 1,
+            difference.origin.y, difference.origin.y + difference.size.h - 1);
+    return false;
+  }
+  return true;
+}
+
+//// Budget.
+
+// Check the steady-state minute tick, and the other handlers per simulated minute, against the
+// budget file; return whether they fit.
+static bool check_budget(const char *path, const HostTrace *trace) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(2);
+  }
+  const HostStats *minute = &host->stats[HANDLER_MINUTE_TICK];
+  double calls = minute->calls ? minute->calls : 1;
+  double minutes = (host->now_ms - trace->start_ms) / (60.0 * 1000.0);
+  if (minutes < 1) {
+    minutes = 1;
+  }
+  bool is_within_budget = true;
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    ++line_number;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    // A line naming a handler limits what it does per simulated minute, not per minute tick.
+    char handler_name[64];
+    char name[64];
+    double limit;
+    HostHandler handler = HANDLER_MINUTE_TICK;
+    int fields = sscanf(line, "%63s %63s %lf", handler_name, name, &limit);
+    if (fields <= 0) {
+      continue;
+    }
+    if (fields == 3) {
+      handler = 0;
+      while (handler < HANDLERS_COUNT && strcmp(handler_names[handler], handler_name)) {
+        ++handler;
+      }
+      if (handler == HANDLERS_COUNT) {
+        host_trace_error(path, line_number, "unknown handler");
+      }
+    } else if (sscanf(line, "%63s %lf", name, &limit) != 2) {
+      host_trace_error(path, line_number, "expected [<handler>] <operation> <limit>");
+    }
+    // The heap is not a cost of the minute tick, but the most used at any time.
+    if (!strcmp(name, "heap")) {
+      if (host->heap_high_water > limit) {
+        fprintf(stderr, "%s: heap high water is %zu bytes, over the budget of %.0f\n",
+                trace->path, host->heap_high_water, limit);
+        is_within_budget = false;
+      }
+      if (host->heap_high_water + host->static_bytes > HOST_APP_BYTES) {
+        fprintf(stderr, "%s: heap high water is %zu bytes, over the %zu left by the code and static data\n",
+                trace->path, host->heap_high_water, HOST_APP_BYTES - host->static_bytes);
+        is_within_budget = false;
+      }
+      continue;
+    }
+    // Besides the operations, the calls themselves can be limited (the wakeups of the timer).
+    const HostStats *stats = &host->stats[handler];
+    double count = stats->calls;
+    if (strcmp(name, "calls")) {
+      HostOp op = 0;
+      while (op < OPS_COUNT && strcmp(op_names[op], name)) {
+        ++op;
+      }
+      if (op == OPS_COUNT) {
+        host_trace_error(path, line_number, "unknown operation");
+      }
+      count = stats->ops[op];
+    }
+    if (handler == HANDLER_MINUTE_TICK) {
+      double actual = count / calls;
+      if (actual > limit + 1e-9) {
+        fprintf(stderr, "%s: %s per minute tick is %.3f, over the budget of %.3f\n",
+                trace->path, name, actual, limit);
+        is_within_budget = false;
+      }
+    } else {
+      double actual = count / minutes;
+      if (actual > limit + 1e-9) {
+        fprintf(stderr, "%s: %s %s per simulated minute is %.4f, over the budget of %.4f\n",
+                trace->path, handler_names[handler], name, actual, limit);
+        is_within_budget = false;
+      }
+    }
+  }
+  fclose(file);
+  return is_within_budget;
+}
+
+//// Main.
+
+#define USAGE "usage: %s [--log] [--png DIR] [--golden DIR] [--budget FILE]... " \
+              "[--static-bytes N] [--telemetry FILE] TRACE...\n"
+
+int main(int argc, char **argv) {
+  // All the traces are in UTC so the results do not depend on the host.
+  setenv("TZ", "UTC0", 1);
+  tzset();
+  host_setup();
+
+  bool is_logging = false;
+  const char *png_directory = NULL;
+  const char *golden_directory = NULL;
+  // Each budget file is checked in turn.
+  const char *budget_paths[4];
+  int budget_paths_count = 0;
+  const char *telemetry_path = NULL;
+  size_t static_bytes = 0;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (!strcmp(argv[arg], "--log")) {
+      is_logging = true;
+    } else if (!strcmp(argv[arg], "--png") && arg + 1 < argc) {
+      png_directory = argv[++arg];
+    } else if (!strcmp(argv[arg], "--golden") && arg + 1 < argc) {
+      golden_directory = argv[++arg];
+    } else if (!strcmp(argv[arg], "--budget") && arg + 1 < argc
+            && budget_paths_count < (int)(sizeof(budget_paths) / sizeof(budget_paths[0]))) {
+      budget_paths[budget_paths_count++] = argv[++arg];
+    } else if (!strcmp(argv[arg], "--static-bytes") && arg + 1 < argc) {
+      static_bytes = strtoul(argv[++arg], NULL, 10);
+    } else if (!strcmp(argv[arg], "--telemetry") && arg + 1 < argc) {
+      telemetry_path = argv[++arg];
+    } else {
+      fprintf(stderr, USAGE, argv[0]);
+      return 2;
+    }
+  }
+  if (arg == argc) {
+    fprintf(stderr, USAGE, argv[0]);
+    return 2;
+  }
+  // The launches append the telemetry of all the traces to the file.
+  if (telemetry_path && truncate(telemetry_path, 0) && errno != ENOENT) {
+    perror(telemetry_path);
+    return 2;
+  }
+
+  bool is_within_budget = true;
+  bool is_golden = true;
+  for (; arg < argc; ++arg) {
+    HostTrace trace = host_load_trace(argv[arg]);
+    replay(&trace, is_logging, telemetry_path, static_bytes);
+    report(&trace);
+    if (png_directory) {
+      write_final_frame(png_directory, &trace);
+    }
+    if (golden_directory && !check_golden_frame(golden_directory, &trace)) {
+      is_golden = false;
+    }
+    for (int which_budget = 0; which_budget < budget_paths_count; ++which_budget) {
+      if (!check_budget(budget_paths[which_budget], &trace)) {
+        is_within_budget = false;
+      }
+    }
+    free(trace.events);
+  }
+  return is_within_budget && is_golden ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+// Host simulation state shared between the stub SDK (pebble_host.c) and the drivers (bench.c, accuracy.c).
+//
+// Each launch of the watchface runs in a forked child process, so that it starts with pristine
+// static variables just like on the watch. Everything that must survive a launch (the simulated
+// clock, the trace position, the persistent storage and the statistics) lives in a shared memory
+// mapping.
+
+#ifndef PEBBLE_HOST_HOST_H
+#define PEBBLE_HOST_HOST_H
+
+#define PEBBLE_HOST_IMPLEMENTATION
+#include "pebble.h"
+
+//// Statistics.
+
+// The operations we count.
+typedef enum {
+  OP_DRAW_TEXT, // Calls to graphics_draw_text (including for text layers).
+  OP_SET_TEXT_SUPPRESSED, // Text updates the watchface suppressed because the text did not change.
+  OP_LAYER_MARK_DIRTY, // Explicit calls to layer_mark_dirty.
+  OP_LAYER_SET_HIDDEN, // Calls to layer_set_hidden which actually changed the visibility.
+  OP_PERSIST_EXISTS, // Calls to persist_exists and persist_get_size.
+  OP_PERSIST_READ, // Calls to persist_read_*.
+  OP_PERSIST_WRITE, // Calls to persist_write_* and persist_delete.
+  OP_SNPRINTF, // Calls to snprintf.
+  OP_STRFTIME, // Calls to strftime.
+  OP_DATA_LOGGING_LOG, // Calls to data_logging_log (each may wake up the radio).
+  OP_TELEMETRY_DROPPED, // Telemetry records the watchface dropped because its buffer was full.
+  OP_EVENTS_QUEUED, // Battery, bluetooth and compass events the watchface queued for committing.
+  OP_SAVED_EVENT_FRAMES, // Frames the watchface saved by not rendering each queued event at once.
+  OP_FRAMES, // Frames rendered because something was invalidated.
+  OP_PIXELS, // Pixels written to the frame buffer while rendering.
+  OP_FILLS, // Calls to graphics_fill_rect which fill with a visible color (including for layers).
+  OP_BLITS, // Calls to graphics_draw_bitmap_in_rect (including for bitmap layers).
+  OPS_COUNT
+} HostOp;
+
+// The handlers we attribute the operations to.
+typedef enum {
+  HANDLER_INIT, // Everything from launch until the event loop starts.
+  HANDLER_SECOND_TICK, // Tick events where only the second changed.
+  HANDLER_MINUTE_TICK, // Tick events where the minute (or hour) changed, but not the day.
+  HANDLER_DAY_TICK, // Tick events where the day changed.
+  HANDLER_BATTERY, // Battery state events.
+  HANDLER_BLUETOOTH, // Bluetooth connection events.
+  HANDLER_COMPASS, // Compass heading events.
+  HANDLER_TAP, // Accelerometer tap events (wrist flicks).
+  HANDLER_HEALTH, // Health service events (movement and sleep).
+  HANDLER_TIMER, // App timer callbacks.
+  HANDLER_FOCUS, // App focus changes (a notification covering the watchface and going away).
+  HANDLER_PEEK, // Unobstructed area changes (each frame of a timeline peek sliding in or out).
+  HANDLER_DEINIT, // Everything from the event loop exit until the app exits.
+  HANDLERS_COUNT
+} HostHandler;
+
+// The statistics collected for a single handler.
+typedef struct {
+  // How many times the handler was invoked.
+  uint64_t calls;
+
+  // The total wall-clock time spent in the handler.
+  uint64_t nanoseconds;
+
+  // The wall-clock time spent rendering the frames the handler invalidated.
+  uint64_t render_nanoseconds;
+
+  // The number of times each operation was performed by the handler.
+  uint64_t ops[OPS_COUNT];
+} HostStats;
+
+//// Trace events.
+
+// The kinds of events in a trace.
+typedef enum {
+  EVENT_BATTERY, // A battery state change.
+  EVENT_BLUETOOTH, // A bluetooth connection change.
+  EVENT_COMPASS, // A raw compass sample (filtered by the heading filter before delivery).
+  EVENT_TAP, // An accelerometer tap (a wrist flick).
+  EVENT_MOVEMENT, // A Health movement update (steps were taken).
+  EVENT_SLEEP, // A Health sleep state change.
+  EVENT_NOTIFICATION, // A notification covering the watchface (trashing the frame buffer) and going away.
+  EVENT_PEEK, // A timeline peek sliding in over the bottom of the watchface, or back out.
+  EVENT_RESTART, // A clean exit of the watchface, followed by a relaunch.
+  EVENT_CRASH, // An abrupt termination of the watchface, followed by a relaunch.
+  EVENT_END, // The end of the trace.
+} HostEventKind;
+
+// A single trace event.
+typedef struct {
+  // The simulated time of the event, in milliseconds since the epoch.
+  int64_t time_ms;
+
+  // The kind of the event.
+  HostEventKind kind;
+
+  // The event data.
+  union {
+    BatteryChargeState battery;
+    bool is_connected;
+    bool is_asleep;
+    bool is_peek_shown;
+    struct {
+      CompassStatus status;
+      int degrees;
+    } compass;
+  };
+} HostEvent;
+
+// A loaded trace.
+typedef struct {
+  // The file it was loaded from.
+  const char *path;
+
+  // The simulated time the trace starts at.
+  int64_t start_ms;
+
+  // The initial state of the simulated services.
+  BatteryChargeState battery;
+  bool is_bluetooth_connected;
+  bool is_24h_style;
+
+  // The events.
+  HostEvent *events;
+  size_t events_count;
+} HostTrace;
+
+// Load a trace file. Each line is one of (with # starting a comment):
+//
+//   start YYYY-MM-DD HH:MM:SS      The (UTC) time the trace starts at.
+//   clock 12h|24h                  The clock style setting.
+//   battery PERCENT [FLAGS]        The initial battery state; FLAGS are charging and/or plugged.
+//   bluetooth [dis]connected       The initial bluetooth connection state.
+//   SECONDS battery PERCENT [FLAGS]
+//   SECONDS bluetooth [dis]connected
+//   SECONDS compass calibrated DEGREES | calibrating | invalid | unavailable
+//   SECONDS tap
+//   SECONDS movement
+//   SECONDS asleep | awake
+//   SECONDS notification
+//   SECONDS peek shown|hidden
+//   SECONDS restart | crash | end
+//
+// Where SECONDS is the offset of the event from the start, and events are in time order.
+HostTrace host_load_trace(const char *path);
+
+// Report an error in a line of an input file and exit.
+void host_trace_error(const char *path, int line_number, const char *message);
+
+//// Shared state.
+
+// The size of the basalt screen.
+#define HOST_SCREEN_WIDTH 144
+#define HOST_SCREEN_HEIGHT 168
+
+// Basalt gives each app 64KB (and aplite only 24KB), for its code and static data as well as its
+// heap.
+#ifdef PBL_PLATFORM_APLITE
+#define HOST_APP_BYTES (24 * 1024)
+#else
+#define HOST_APP_BYTES (64 * 1024)
+#endif
+
+// The maximal number of persistent keys (the real limit is 4KB total).
+#define HOST_PERSIST_KEYS 64
+
+// A single persistent value.
+typedef struct {
+  bool is_used;
+  uint32_t key;
+  uint16_t size;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} HostPersist;
+
+// The state shared between all launches of the watchface.
+typedef struct {
+  // The simulated wall clock, in milliseconds since the epoch.
+  int64_t now_ms;
+
+  // The trace being replayed (inherited by the forked launches).
+  const HostEvent *events;
+  size_t events_count;
+
+  // The index of the next trace event to replay.
+  size_t next_event;
+
+  // Whether the trace was fully replayed.
+  bool is_finished;
+
+  // How many times the watchface was launched.
+  int launches;
+
+  // How long the watchface kept the compass service subscribed (the magnetometer on).
+  int64_t compass_on_ms;
+
+  // The most heap the watchface used at any time, over all launches.
+  size_t heap_high_water;
+
+  // The bytes of the watchface code and static data, which leave that much less of the app memory
+  // for the heap (0 if not known).
+  size_t static_bytes;
+
+  // The wall-clock time from the start of each launch until its first frame was rendered, summed
+  // over all launches.
+  uint64_t first_frame_nanoseconds;
+
+  // The current state of the simulated services.
+  BatteryChargeState battery;
+  bool is_bluetooth_connected;
+  bool is_24h_style;
+  bool is_asleep;
+
+  // How many rows at the bottom of the screen a timeline peek covers (0 when there is none).
+  int obstruction_height;
+
+  // Whether to print every change of the displayed texts, and the APP_LOG messages.
+  bool is_logging;
+
+  // The file to append the items logged through DataLogging to, if any.
+  char data_logging_path[1024];
+
+  // The persistent storage.
+  HostPersist persist[HOST_PERSIST_KEYS];
+
+  // The frame buffer, as left by the last rendered frame.
+  GColor8 framebuffer[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH];
+
+  // The statistics of each handler.
+  HostStats stats[HANDLERS_COUNT];
+} HostState;
+
+// The shared state, mapped by host_setup.
+extern HostState *host;
+
+// Map the shared state; must be called once before anything else.
+void host_setup(void);
+
+// Run a single launch of the watchface in the current (child) process.
+void host_launch(int (*watchface_main)(void));
+
+// Write the frame buffer as a PNG file.
+void host_write_framebuffer(const char *path);
+
+// Compare the frame buffer with a PNG file written by host_write_framebuffer. Return how many pixels
+// differ (setting the bounding rectangle of the differences), or -1 if the file can't be read.
+int host_compare_framebuffer(const char *path, GRect *difference);
+
+#endif // PEBBLE_HOST_HOST_H
@@ -0,0 +1,584 @@
+// Minimal stand-in for the Pebble SDK <pebble.h>, for compiling the watchface on a Linux host.
+//
+// Only the parts of the SDK the watchface actually uses are declared here, with the same names and
+// signatures as the real SDK. The implementation in pebble_host.c counts and times the calls, and
+// replays a recorded trace of events into the subscribed handlers (see bench.c).
+
+#ifndef PEBBLE_HOST_PEBBLE_H
+#define PEBBLE_HOST_PEBBLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "resource_ids.auto.h"
+
+//// Platform.
+
+// The SDK defines these for each platform it builds. The host builds basalt, or aplite when
+// compiled with -DPBL_PLATFORM_APLITE (make APLITE=1).
+#ifdef PBL_PLATFORM_APLITE
+#define PBL_BW
+#else
+#define PBL_PLATFORM_BASALT
+#define PBL_COLOR
+#define PBL_HEALTH
+#endif
+#define PBL_RECT
+
+#ifdef PBL_COLOR
+#define PBL_IF_COLOR_ELSE(if_true, if_false) (if_true)
+#else
+#define PBL_IF_COLOR_ELSE(if_true, if_false) (if_false)
+#endif
+
+//// Status codes.
+
+typedef int32_t status_t;
+
+typedef enum {
+  S_SUCCESS = 0,
+  E_ERROR = -1,
+  E_UNKNOWN = -2,
+  E_INTERNAL = -3,
+  E_INVALID_ARGUMENT = -4,
+  E_OUT_OF_MEMORY = -5,
+  E_OUT_OF_STORAGE = -6,
+  E_OUT_OF_RESOURCES = -7,
+  E_RANGE = -8,
+  E_DOES_NOT_EXIST = -9,
+  E_INVALID_OPERATION = -10,
+  E_BUSY = -11,
+  E_AGAIN = -12,
+  S_TRUE = 1,
+  S_FALSE = 0,
+  S_NO_MORE_ITEMS = 2,
+  S_NO_ACTION_REQUIRED = 3,
+} StatusCode;
+
+//// Logging.
+
+typedef enum {
+  APP_LOG_LEVEL_ERROR = 1,
+  APP_LOG_LEVEL_WARNING = 50,
+  APP_LOG_LEVEL_INFO = 100,
+  APP_LOG_LEVEL_DEBUG = 200,
+  APP_LOG_LEVEL_DEBUG_VERBOSE = 255,
+} AppLogLevel;
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...)
+  __attribute__((format(printf, 4, 5)));
+
+#define APP_LOG(level, fmt, args...) app_log(level, __FILE__, __LINE__, fmt, ## args)
+
+//// Memory.
+
+size_t heap_bytes_used(void);
+
+size_t heap_bytes_free(void);
+
+//// Geometry.
+
+typedef struct GPoint {
+  int16_t x;
+  int16_t y;
+} GPoint;
+
+#define GPoint(x, y) ((GPoint){(x), (y)})
+
+typedef struct GSize {
+  int16_t w;
+  int16_t h;
+} GSize;
+
+#define GSize(w, h) ((GSize){(w), (h)})
+
+#define GSizeZero GSize(0, 0)
+
+typedef struct GRect {
+  GPoint origin;
+  GSize size;
+} GRect;
+
+#define GRect(x, y, w, h) ((GRect){{(x), (y)}, {(w), (h)}})
+
+#define GRectZero GRect(0, 0, 0, 0)
+
+void grect_clip(GRect * const rect_to_clip, const GRect * const rect_clipper);
+
+bool grect_equal(const GRect * const rect_a, const GRect * const rect_b);
+
+//// Colors.
+
+typedef union GColor8 {
+  uint8_t argb;
+  struct {
+    uint8_t b:2;
+    uint8_t g:2;
+    uint8_t r:2;
+    uint8_t a:2;
+  };
+} GColor8;
+
+typedef GColor8 GColor;
+
+#define GColorClearARGB8 ((uint8_t)0x00)
+#define GColorBlackARGB8 ((uint8_t)0xC0)
+#define GColorWhiteARGB8 ((uint8_t)0xFF)
+#define GColorRedARGB8 ((uint8_t)0xF0)
+#define GColorOrangeARGB8 ((uint8_t)0xF4)
+#define GColorYellowARGB8 ((uint8_t)0xFC)
+#define GColorGreenARGB8 ((uint8_t)0xCC)
+#define GColorCyanARGB8 ((uint8_t)0xCF)
+#define GColorRichBrilliantLavenderARGB8 ((uint8_t)0xFB)
+#define GColorMidnightGreenARGB8 ((uint8_t)0xC5)
+
+#define GColorClear ((GColor8){.argb = GColorClearARGB8})
+#define GColorBlack ((GColor8){.argb = GColorBlackARGB8})
+#define GColorWhite ((GColor8){.argb = GColorWhiteARGB8})
+#define GColorRed ((GColor8){.argb = GColorRedARGB8})
+#define GColorOrange ((GColor8){.argb = GColorOrangeARGB8})
+#define GColorYellow ((GColor8){.argb = GColorYellowARGB8})
+#define GColorGreen ((GColor8){.argb = GColorGreenARGB8})
+
+bool gcolor_equal(GColor8 color_a, GColor8 color_b);
+
+//// Graphics.
+
+typedef struct GContext GContext;
+
+typedef struct GBitmap GBitmap;
+
+typedef struct GFont *GFont;
+
+typedef enum {
+  GCornerNone = 0,
+  GCornerTopLeft = 1 << 0,
+  GCornerTopRight = 1 << 1,
+  GCornerBottomLeft = 1 << 2,
+  GCornerBottomRight = 1 << 3,
+  GCornersAll = GCornerTopLeft | GCornerTopRight | GCornerBottomLeft | GCornerBottomRight,
+  GCornersTop = GCornerTopLeft | GCornerTopRight,
+  GCornersBottom = GCornerBottomLeft | GCornerBottomRight,
+  GCornersLeft = GCornerTopLeft | GCornerBottomLeft,
+  GCornersRight = GCornerTopRight | GCornerBottomRight,
+} GCornerMask;
+
+typedef enum {
+  GCompOpAssign,
+  GCompOpAssignInverted,
+  GCompOpOr,
+  GCompOpAnd,
+  GCompOpClear,
+  GCompOpSet,
+} GCompOp;
+
+typedef enum {
+  GTextOverflowModeWordWrap,
+  GTextOverflowModeTrailingEllipsis,
+  GTextOverflowModeFill,
+} GTextOverflowMode;
+
+typedef enum {
+  GTextAlignmentLeft,
+  GTextAlignmentCenter,
+  GTextAlignmentRight,
+} GTextAlignment;
+
+typedef struct GTextAttributes GTextAttributes;
+
+typedef enum {
+  GBitmapFormat1Bit,
+  GBitmapFormat8Bit,
+  GBitmapFormat1BitPalette,
+  GBitmapFormat2BitPalette,
+  GBitmapFormat4BitPalette,
+  GBitmapFormat8BitCircular,
+} GBitmapFormat;
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode);
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+                        const GTextOverflowMode overflow_mode, const GTextAlignment alignment,
+                        GTextAttributes *text_attributes);
+
+GSize graphics_text_layout_get_content_size(const char *text, GFont const font, const GRect box,
+                                            const GTextOverflowMode overflow_mode,
+                                            const GTextAlignment alignment);
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+
+GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap *base_bitmap, GRect sub_rect);
+
+GBitmap *gbitmap_create_blank(GSize size, GBitmapFormat format);
+
+void gbitmap_destroy(GBitmap *bitmap);
+
+GRect gbitmap_get_bounds(const GBitmap *bitmap);
+
+void gbitmap_set_bounds(GBitmap *bitmap, GRect bounds);
+
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap);
+
+uint8_t *gbitmap_get_data(const GBitmap *bitmap);
+
+uint16_t gbitmap_get_bytes_per_row(const GBitmap *bitmap);
+
+GBitmap *graphics_capture_frame_buffer(GContext *ctx);
+
+bool graphics_release_frame_buffer(GContext *ctx, GBitmap *buffer);
+
+//// Resources and fonts.
+
+typedef void *ResHandle;
+
+ResHandle resource_get_handle(uint32_t resource_id);
+
+GFont fonts_load_custom_font(ResHandle handle);
+
+void fonts_unload_custom_font(GFont font);
+
+//// Layers.
+
+typedef struct Layer Layer;
+
+typedef void (*LayerUpdateProc)(struct Layer *layer, GContext *ctx);
+
+Layer *layer_create(GRect frame);
+
+Layer *layer_create_with_data(GRect frame, size_t data_size);
+
+void *layer_get_data(const Layer *layer);
+
+void layer_destroy(Layer *layer);
+
+void layer_mark_dirty(Layer *layer);
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+
+GRect layer_get_frame(const Layer *layer);
+
+void layer_set_frame(Layer *layer, GRect frame);
+
+GRect layer_get_bounds(const Layer *layer);
+
+GRect layer_get_unobstructed_bounds(const Layer *layer);
+
+void layer_add_child(Layer *parent, Layer *child);
+
+void layer_remove_from_parent(Layer *child);
+
+void layer_set_hidden(Layer *layer, bool hidden);
+
+bool layer_get_hidden(const Layer *layer);
+
+typedef struct TextLayer TextLayer;
+
+TextLayer *text_layer_create(GRect frame);
+
+void text_layer_destroy(TextLayer *text_layer);
+
+Layer *text_layer_get_layer(TextLayer *text_layer);
+
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+
+const char *text_layer_get_text(TextLayer *text_layer);
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+
+typedef struct BitmapLayer BitmapLayer;
+
+BitmapLayer *bitmap_layer_create(GRect frame);
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+
+//// Windows.
+
+typedef struct Window Window;
+
+typedef void (*WindowHandler)(struct Window *window);
+
+typedef struct WindowHandlers {
+  WindowHandler load;
+  WindowHandler appear;
+  WindowHandler disappear;
+  WindowHandler unload;
+} WindowHandlers;
+
+Window *window_create(void);
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+
+void window_destroy(Window *window);
+
+void window_stack_push(Window *window, bool animated);
+
+Layer *window_get_root_layer(const Window *window);
+
+void window_set_background_color(Window *window, GColor background_color);
+
+//// Event loop.
+
+void app_event_loop(void);
+
+//// Timers.
+
+typedef struct AppTimer AppTimer;
+
+typedef void (*AppTimerCallback)(void *data);
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data);
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms);
+
+void app_timer_cancel(AppTimer *timer_handle);
+
+//// App focus.
+
+typedef void (*AppFocusHandler)(bool in_focus);
+
+typedef struct AppFocusHandlers {
+  AppFocusHandler will_focus;
+  AppFocusHandler did_focus;
+} AppFocusHandlers;
+
+void app_focus_service_subscribe_handlers(AppFocusHandlers handlers);
+
+void app_focus_service_unsubscribe(void);
+
+//// Unobstructed area.
+
+typedef int32_t AnimationProgress;
+
+#define ANIMATION_NORMALIZED_MAX 65535
+
+typedef void (*UnobstructedAreaWillChangeHandler)(GRect final_unobstructed_screen_area, void *context);
+
+typedef void (*UnobstructedAreaChangeHandler)(AnimationProgress progress, void *context);
+
+typedef void (*UnobstructedAreaDidChangeHandler)(void *context);
+
+typedef struct UnobstructedAreaHandlers {
+  UnobstructedAreaWillChangeHandler will_change;
+  UnobstructedAreaChangeHandler change;
+  UnobstructedAreaDidChangeHandler did_change;
+} UnobstructedAreaHandlers;
+
+void unobstructed_area_service_subscribe(UnobstructedAreaHandlers handlers, void *context);
+
+void unobstructed_area_service_unsubscribe(void);
+
+//// Time.
+
+typedef enum {
+  SECOND_UNIT = 1 << 0,
+  MINUTE_UNIT = 1 << 1,
+  HOUR_UNIT = 1 << 2,
+  DAY_UNIT = 1 << 3,
+  MONTH_UNIT = 1 << 4,
+  YEAR_UNIT = 1 << 5,
+} TimeUnits;
+
+typedef void (*TickHandler)(struct tm *tick_time, TimeUnits units_changed);
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler);
+
+void tick_timer_service_unsubscribe(void);
+
+bool clock_is_24h_style(void);
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms);
+
+//// Battery.
+
+typedef struct {
+  uint8_t charge_percent;
+  bool is_charging;
+  bool is_plugged;
+} BatteryChargeState;
+
+typedef void (*BatteryStateHandler)(BatteryChargeState charge);
+
+BatteryChargeState battery_state_service_peek(void);
+
+void battery_state_service_subscribe(BatteryStateHandler handler);
+
+void battery_state_service_unsubscribe(void);
+
+//// Bluetooth.
+
+typedef void (*BluetoothConnectionHandler)(bool connected);
+
+bool bluetooth_connection_service_peek(void);
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler);
+
+void bluetooth_connection_service_unsubscribe(void);
+
+//// Compass.
+
+#define TRIG_MAX_ANGLE 0x10000
+
+#define TRIGANGLE_TO_DEG(trig_angle) (((trig_angle) * 360) / TRIG_MAX_ANGLE)
+
+#define DEG_TO_TRIGANGLE(angle) (((angle) * TRIG_MAX_ANGLE) / 360)
+
+typedef int32_t CompassHeading;
+
+typedef enum {
+  CompassStatusUnavailable = -1,
+  CompassStatusDataInvalid = 0,
+  CompassStatusCalibrating,
+  CompassStatusCalibrated,
+} CompassStatus;
+
+typedef struct {
+  CompassHeading magnetic_heading;
+  CompassHeading true_heading;
+  CompassStatus compass_status;
+  bool is_declination_valid;
+} CompassHeadingData;
+
+typedef void (*CompassHeadingHandler)(CompassHeadingData heading);
+
+int compass_service_set_heading_filter(CompassHeading filter);
+
+void compass_service_subscribe(CompassHeadingHandler handler);
+
+void compass_service_unsubscribe(void);
+
+//// Accelerometer.
+
+typedef enum {
+  ACCEL_AXIS_X = 0,
+  ACCEL_AXIS_Y = 1,
+  ACCEL_AXIS_Z = 2,
+} AccelAxisType;
+
+typedef void (*AccelTapHandler)(AccelAxisType axis, int32_t direction);
+
+void accel_tap_service_subscribe(AccelTapHandler handler);
+
+void accel_tap_service_unsubscribe(void);
+
+//// Health.
+
+// Like the SDK, only declared where the platform has the Health service, so the aplite build fails
+// to compile if the watchface uses it unguarded.
+#ifdef PBL_HEALTH
+typedef enum {
+  HealthEventSignificantUpdate = 0,
+  HealthEventMovementUpdate,
+  HealthEventSleepUpdate,
+  HealthEventMetricAlert,
+  HealthEventHeartRateUpdate,
+} HealthEventType;
+
+typedef void (*HealthEventHandler)(HealthEventType event, void *context);
+
+bool health_service_events_subscribe(HealthEventHandler handler, void *context);
+
+bool health_service_events_unsubscribe(void);
+
+typedef enum {
+  HealthActivityNone = 0,
+  HealthActivitySleep = 1 << 0,
+  HealthActivityRestfulSleep = 1 << 1,
+  HealthActivityWalk = 1 << 2,
+  HealthActivityRun = 1 << 3,
+  HealthActivityOpenWorkout = 1 << 4,
+} HealthActivity;
+
+typedef uint32_t HealthActivityMask;
+
+HealthActivityMask health_service_peek_current_activities(void);
+#endif
+
+//// Persistent storage.
+
+#define PERSIST_DATA_MAX_LENGTH 256
+
+bool persist_exists(const uint32_t key);
+
+int persist_get_size(const uint32_t key);
+
+bool persist_read_bool(const uint32_t key);
+
+int32_t persist_read_int(const uint32_t key);
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size);
+
+status_t persist_write_bool(const uint32_t key, const bool value);
+
+status_t persist_write_int(const uint32_t key, const int32_t value);
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size);
+
+status_t persist_delete(const uint32_t key);
+
+//// Data logging.
+
+typedef void *DataLoggingSessionRef;
+
+typedef enum {
+  DATA_LOGGING_BYTE_ARRAY = 0,
+  DATA_LOGGING_UINT = 2,
+  DATA_LOGGING_INT = 3,
+} DataLoggingItemType;
+
+typedef enum {
+  DATA_LOGGING_SUCCESS = 0,
+  DATA_LOGGING_BUSY,
+  DATA_LOGGING_FULL,
+  DATA_LOGGING_NOT_FOUND,
+  DATA_LOGGING_CLOSED,
+  DATA_LOGGING_INVALID_PARAMS,
+  DATA_LOGGING_INTERNAL_ERR,
+} DataLoggingResult;
+
+DataLoggingSessionRef data_logging_create(uint32_t tag, DataLoggingItemType item_type, uint16_t item_length,
+                                          bool resume);
+
+DataLoggingResult data_logging_log(DataLoggingSessionRef logging_session, const void *data, uint32_t num_items);
+
+void data_logging_finish(DataLoggingSessionRef logging_session);
+
+//// Host instrumentation.
+
+// Counted and timed replacements for the C library calls the watchface makes. The watchface code
+// is compiled unchanged; these macros route its calls through the host's bookkeeping.
+
+time_t host_time(time_t *timer);
+
+int host_snprintf(char *str, size_t size, const char *format, ...)
+  __attribute__((format(printf, 3, 4)));
+
+size_t host_strftime(char *s, size_t max, const char *format, const struct tm *tm);
+
+#ifndef PEBBLE_HOST_IMPLEMENTATION
+#define time(timer) host_time(timer)
+#define snprintf host_snprintf
+#define strftime host_strftime
+#endif
+
+#endif // PEBBLE_HOST_PEBBLE_H
@@ -0,0 +1,1819 @@
+// Host implementation of the stub pebble.h.
+//
+// The layers, services and storage are simulated just enough for the watchface to run. Every call
+// the watchface makes is attributed to the handler currently running, so the benchmark driver can
+// report the cost of each kind of event.
+//
+// Frames are rendered in software into a frame buffer which is retained between frames, like on the
+// watch. Bitmaps are loaded from the PNG resources, and texts are rendered from the TrueType
+// resources using FreeType (so they are close to, but not exactly, what the SDK font compiler does).
+
+#define _GNU_SOURCE
+
+#include "host.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <png.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+HostState *host;
+
+void host_setup(void) {
+  host = mmap(NULL, sizeof(HostState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (host == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  memset(host, 0, sizeof(*host));
+}
+
+//// Accounting.
+
+// The handler we attribute the operations to.
+static HostHandler current_handler = HANDLER_INIT;
+
+// When the current handler started.
+static uint64_t handler_start_ns;
+
+// Whether anything was invalidated since the last frame.
+static bool is_dirty;
+
+// The watchface's own counters, if it keeps them.
+extern uint32_t suppressed_text_updates __attribute__((weak));
+extern uint32_t queued_events __attribute__((weak));
+extern uint32_t saved_event_frames __attribute__((weak));
+extern uint32_t dropped_telemetry_records __attribute__((weak));
+
+// The operation each of the watchface's counters counts.
+static const struct {
+  uint32_t *counter;
+  HostOp op;
+} watchface_counters[] = {
+  { &suppressed_text_updates, OP_SET_TEXT_SUPPRESSED },
+  { &queued_events, OP_EVENTS_QUEUED },
+  { &saved_event_frames, OP_SAVED_EVENT_FRAMES },
+  { &dropped_telemetry_records, OP_TELEMETRY_DROPPED },
+};
+
+#define WATCHFACE_COUNTERS_COUNT (sizeof(watchface_counters) / sizeof(watchface_counters[0]))
+
+// The above when the current handler started.
+static uint32_t handler_start_counters[WATCHFACE_COUNTERS_COUNT];
+
+static uint32_t watchface_counter(size_t index) {
+  return watchface_counters[index].counter ? *watchface_counters[index].counter : 0;
+}
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void count(HostOp op) {
+  ++host->stats[current_handler].ops[op];
+}
+
+static void begin_handler(HostHandler handler) {
+  current_handler = handler;
+  for (size_t index = 0; index < WATCHFACE_COUNTERS_COUNT; ++index) {
+    handler_start_counters[index] = watchface_counter(index);
+  }
+  handler_start_ns = monotonic_ns();
+}
+
+static void render_frame(void);
+
+// When the current launch started, and whether it rendered its first frame yet.
+static uint64_t launch_start_ns;
+static bool is_first_frame_rendered;
+
+static void end_handler(void) {
+  HostStats *stats = &host->stats[current_handler];
+  stats->nanoseconds += monotonic_ns() - handler_start_ns;
+  ++stats->calls;
+  for (size_t index = 0; index < WATCHFACE_COUNTERS_COUNT; ++index) {
+    stats->ops[watchface_counters[index].op] += watchface_counter(index) - handler_start_counters[index];
+  }
+  if (is_dirty && current_handler != HANDLER_DEINIT) {
+    is_dirty = false;
+    count(OP_FRAMES);
+    uint64_t render_start_ns = monotonic_ns();
+    render_frame();
+    uint64_t render_end_ns = monotonic_ns();
+    stats->render_nanoseconds += render_end_ns - render_start_ns;
+    if (!is_first_frame_rendered) {
+      is_first_frame_rendered = true;
+      host->first_frame_nanoseconds += render_end_ns - launch_start_ns;
+    }
+  }
+}
+
+static void invalidate(void) {
+  is_dirty = true;
+}
+
+//// Logging.
+
+static void log_prefix(void) {
+  time_t now = host->now_ms / 1000;
+  char stamp[20];
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+  printf("%s ", stamp);
+}
+
+void app_log(uint8_t log_level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+  if (!host->is_logging) {
+    return;
+  }
+  log_prefix();
+  printf("log %s:%d ", src_filename, src_line_number);
+  va_list args;
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+  printf("\n");
+}
+
+//// Heap.
+
+// The heap the watchface uses in the current launch.
+static size_t heap_used;
+
+// Prefixes each allocation, so freeing it can account for its size.
+typedef union {
+  size_t size;
+  long double alignment;
+} HeapHeader;
+
+// Allocate zeroed memory for an object the watch would allocate on the app heap.
+static void *heap_calloc(size_t size) {
+  HeapHeader *header = calloc(1, sizeof(HeapHeader) + size);
+  header->size = size;
+  heap_used += size;
+  if (heap_used > host->heap_high_water) {
+    host->heap_high_water = heap_used;
+  }
+  return header + 1;
+}
+
+static void heap_free(void *data) {
+  if (!data) {
+    return;
+  }
+  HeapHeader *header = (HeapHeader *)data - 1;
+  heap_used -= header->size;
+  free(header);
+}
+
+size_t heap_bytes_used(void) {
+  return heap_used;
+}
+
+size_t heap_bytes_free(void) {
+  // Without the size of the code and static data, this is an upper bound.
+  return HOST_APP_BYTES - host->static_bytes - heap_used;
+}
+
+//// Geometry and colors.
+
+void grect_clip(GRect * const rect_to_clip, const GRect * const rect_clipper) {
+  int left = rect_to_clip->origin.x > rect_clipper->origin.x ? rect_to_clip->origin.x : rect_clipper->origin.x;
+  int top = rect_to_clip->origin.y > rect_clipper->origin.y ? rect_to_clip->origin.y : rect_clipper->origin.y;
+  int right = rect_to_clip->origin.x + rect_to_clip->size.w;
+  int clipper_right = rect_clipper->origin.x + rect_clipper->size.w;
+  if (right > clipper_right) {
+    right = clipper_right;
+  }
+  int bottom = rect_to_clip->origin.y + rect_to_clip->size.h;
+  int clipper_bottom = rect_clipper->origin.y + rect_clipper->size.h;
+  if (bottom > clipper_bottom) {
+    bottom = clipper_bottom;
+  }
+  *rect_to_clip = GRect(left, top, right > left ? right - left : 0, bottom > top ? bottom - top : 0);
+}
+
+bool grect_equal(const GRect * const rect_a, const GRect * const rect_b) {
+  return rect_a->origin.x == rect_b->origin.x && rect_a->origin.y == rect_b->origin.y
+      && rect_a->size.w == rect_b->size.w && rect_a->size.h == rect_b->size.h;
+}
+
+bool gcolor_equal(GColor8 color_a, GColor8 color_b) {
+  return color_a.argb == color_b.argb;
+}
+
+//// Resources.
+
+static const char *resource_files[] = HOST_RESOURCE_FILES;
+
+static const char *resource_names[] = HOST_RESOURCE_NAMES;
+
+// The glyphs of each font resource.
+static const char *resource_glyphs[] = HOST_RESOURCE_GLYPHS;
+
+// The estimated heap bytes each font resource takes once loaded.
+static const size_t resource_heap_bytes[] = HOST_RESOURCE_HEAP_BYTES;
+
+// The full path of the file of a resource.
+static void resource_path(uint32_t resource_id, char *path, size_t size) {
+  if (resource_id == INVALID_RESOURCE || resource_id >= sizeof(resource_files) / sizeof(*resource_files)) {
+    fprintf(stderr, "invalid resource id %u\n", resource_id);
+    exit(1);
+  }
+  snprintf(path, size, "%s/%s", HOST_RESOURCES_DIR, resource_files[resource_id]);
+}
+
+ResHandle resource_get_handle(uint32_t resource_id) {
+  return (ResHandle)(uintptr_t)resource_id;
+}
+
+//// Bitmaps.
+
+struct GBitmap {
+  // The size of the pixel data.
+  GSize size;
+
+  // The part of the pixel data the bitmap represents.
+  GRect bounds;
+
+  // The format of the pixel data: a GColor8 per pixel (8Bit), or a bit per pixel (1Bit), which is
+  // white if set, with the leftmost pixel of each byte in its least significant bit.
+  GBitmapFormat format;
+
+  // The bytes of each row of the pixel data.
+  uint16_t bytes_per_row;
+
+  // The pixel data (shared with the base bitmap for sub-bitmaps).
+  uint8_t *data;
+
+  // Whether we need to free the pixel data.
+  bool is_owner;
+};
+
+// Convert an 8-bit color channel to the nearest 2-bit one, like the SDK resource compiler.
+static uint8_t channel_2bit(uint8_t channel) {
+  return (channel + 42) / 85;
+}
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+  char path[1024];
+  resource_path(resource_id, path, sizeof(path));
+  png_image image = { .version = PNG_IMAGE_VERSION };
+  if (!png_image_begin_read_from_file(&image, path)) {
+    fprintf(stderr, "%s: %s\n", path, image.message);
+    exit(1);
+  }
+  image.format = PNG_FORMAT_RGBA;
+  uint8_t *rgba = malloc(PNG_IMAGE_SIZE(image));
+  if (!png_image_finish_read(&image, NULL, rgba, 0, NULL)) {
+    fprintf(stderr, "%s: %s\n", path, image.message);
+    exit(1);
+  }
+  GBitmap *bitmap = heap_calloc(sizeof(GBitmap));
+  bitmap->size = GSize(image.width, image.height);
+  bitmap->bounds = GRect(0, 0, image.width, image.height);
+  bitmap->format = GBitmapFormat8Bit;
+  bitmap->bytes_per_row = image.width * sizeof(GColor8);
+  bitmap->data = heap_calloc(image.width * image.height * sizeof(GColor8));
+  bitmap->is_owner = true;
+  GColor8 *pixels = (GColor8 *)bitmap->data;
+  for (uint32_t index = 0; index < image.width * image.height; ++index) {
+    const uint8_t *pixel = rgba + 4 * index;
+    pixels[index] = (GColor8){ .r = channel_2bit(pixel[0]), .g = channel_2bit(pixel[1]),
+                               .b = channel_2bit(pixel[2]), .a = channel_2bit(pixel[3]) };
+  }
+  free(rgba);
+  return bitmap;
+}
+
+GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap *base_bitmap, GRect sub_rect) {
+  GBitmap *bitmap = heap_calloc(sizeof(GBitmap));
+  *bitmap = *base_bitmap;
+  bitmap->is_owner = false;
+  grect_clip(&sub_rect, &base_bitmap->bounds);
+  bitmap->bounds = sub_rect;
+  return bitmap;
+}
+
+// Only the formats the stub can draw; the others are an error rather than a silent mismatch.
+GBitmap *gbitmap_create_blank(GSize size, GBitmapFormat format) {
+  if (format != GBitmapFormat1Bit && format != GBitmapFormat8Bit) {
+    fprintf(stderr, "unsupported bitmap format %d\n", format);
+    exit(1);
+  }
+  GBitmap *bitmap = heap_calloc(sizeof(GBitmap));
+  bitmap->size = size;
+  bitmap->bounds = GRect(0, 0, size.w, size.h);
+  bitmap->format = format;
+  // Like the SDK, the rows of 1-bit bitmaps are padded to whole 32 bit words.
+  bitmap->bytes_per_row = format == GBitmapFormat1Bit ? (size.w + 31) / 32 * 4 : size.w;
+  bitmap->data = heap_calloc(bitmap->bytes_per_row * size.h);
+  bitmap->is_owner = true;
+  return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+  if (bitmap->is_owner) {
+    heap_free(bitmap->data);
+  }
+  heap_free(bitmap);
+}
+
+GRect gbitmap_get_bounds(const GBitmap *bitmap) {
+  return bitmap->bounds;
+}
+
+void gbitmap_set_bounds(GBitmap *bitmap, GRect bounds) {
+  bitmap->bounds = bounds;
+}
+
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap) {
+  return bitmap->format;
+}
+
+uint8_t *gbitmap_get_data(const GBitmap *bitmap) {
+  return bitmap->data;
+}
+
+uint16_t gbitmap_get_bytes_per_row(const GBitmap *bitmap) {
+  return bitmap->bytes_per_row;
+}
+
+// The color of a pixel of the bitmap data.
+static GColor8 gbitmap_pixel(const GBitmap *bitmap, int x, int y) {
+  const uint8_t *row = bitmap->data + y * bitmap->bytes_per_row;
+  if (bitmap->format == GBitmapFormat1Bit) {
+    return row[x / 8] & (1 << (x % 8)) ? GColorWhite : GColorBlack;
+  }
+  return ((const GColor8 *)row)[x];
+}
+
+//// Fonts.
+
+// The shared FreeType library instance.
+static FT_Library freetype;
+
+struct GFont {
+  // The FreeType face rendering the glyphs.
+  FT_Face face;
+
+  // The distance between the tops of consecutive lines.
+  int line_height;
+
+  // The distance between the top of a line and its baseline.
+  int ascender;
+
+  // The name of the font resource.
+  const char *name;
+
+  // The glyphs of the font resource; the watch would draw anything else as a placeholder box.
+  const char *glyphs;
+};
+
+GFont fonts_load_custom_font(ResHandle handle) {
+  uint32_t resource_id = (uint32_t)(uintptr_t)handle;
+  char path[1024];
+  resource_path(resource_id, path, sizeof(path));
+  // Like the SDK, the pixel size of a font is the number at the end of its resource name.
+  const char *name = resource_names[resource_id];
+  const char *size = name + strlen(name);
+  while (size > name && '0' <= size[-1] && size[-1] <= '9') {
+    --size;
+  }
+  if (!freetype && FT_Init_FreeType(&freetype)) {
+    fprintf(stderr, "failed to initialize FreeType\n");
+    exit(1);
+  }
+  // The watch keeps the font resource on the heap, which FreeType does for us, so we just account for it.
+  GFont font = heap_calloc(sizeof(struct GFont) + resource_heap_bytes[resource_id]);
+  if (!*size || FT_New_Face(freetype, path, 0, &font->face)
+   || FT_Set_Pixel_Sizes(font->face, 0, atoi(size))) {
+    fprintf(stderr, "%s: failed to load font %s\n", path, name);
+    exit(1);
+  }
+  font->line_height = font->face->size->metrics.height >> 6;
+  font->ascender = font->face->size->metrics.ascender >> 6;
+  font->name = name;
+  font->glyphs = resource_glyphs[resource_id];
+  return font;
+}
+
+void fonts_unload_custom_font(GFont font) {
+  FT_Done_Face(font->face);
+  heap_free(font);
+}
+
+// Render a single glyph as a monochrome bitmap, returning whether it exists in the font.
+static bool load_glyph(GFont font, char character) {
+  if (!strchr(font->glyphs, character)) {
+    fprintf(stderr, "glyph '%c' is not in font %s\n", character, font->name);
+    exit(1);
+  }
+  FT_UInt index = FT_Get_Char_Index(font->face, (unsigned char)character);
+  return index && !FT_Load_Glyph(font->face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_MONO);
+}
+
+// The width of a single line of text (up to a newline or the end of the text).
+static int line_width(GFont font, const char *line) {
+  int width = 0;
+  for (const char *c = line; *c && *c != '\n'; ++c) {
+    if (load_glyph(font, *c)) {
+      width += font->face->glyph->advance.x >> 6;
+    }
+  }
+  return width;
+}
+
+//// Graphics.
+
+struct GContext {
+  // The screen position of the drawing box origin (the top-left of the layer).
+  GPoint offset;
+
+  // The screen rectangle we are allowed to draw into.
+  GRect clip;
+
+  // The drawing state.
+  GColor fill_color;
+  GColor text_color;
+  GCompOp compositing_mode;
+};
+
+// The texts drawn on the screen, for logging the display changes.
+typedef struct {
+  // The screen position of the drawing box, which identifies the text.
+  GPoint origin;
+
+  // The screen rectangle covered by the glyphs.
+  GRect ink;
+
+  // The drawn text.
+  char text[32];
+
+  // Whether the text is still visible (was not drawn over by anything else).
+  bool is_visible;
+} ShownText;
+
+#define SHOWN_TEXTS 32
+
+static ShownText shown_texts[SHOWN_TEXTS];
+
+static bool grect_intersects(GRect rect_a, GRect rect_b) {
+  grect_clip(&rect_a, &rect_b);
+  return rect_a.size.w > 0 && rect_a.size.h > 0;
+}
+
+// Forget about the texts overwritten by something drawn into the screen rectangle.
+static void overwrite_shown_texts(GRect rect) {
+  for (int index = 0; index < SHOWN_TEXTS; ++index) {
+    if (shown_texts[index].is_visible && grect_intersects(shown_texts[index].ink, rect)) {
+      shown_texts[index].is_visible = false;
+    }
+  }
+}
+
+static void put_pixel(GContext *ctx, int x, int y, GColor8 color) {
+  host->framebuffer[y][x] = color;
+  count(OP_PIXELS);
+}
+
+// Convert a rectangle in drawing box coordinates to a clipped screen rectangle.
+static GRect screen_rect(GContext *ctx, GRect rect) {
+  rect.origin.x += ctx->offset.x;
+  rect.origin.y += ctx->offset.y;
+  grect_clip(&rect, &ctx->clip);
+  return rect;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+  ctx->fill_color = color;
+}
+
+void graphics_context_set_text_color(GContext *ctx, GColor color) {
+  ctx->text_color = color;
+}
+
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) {
+  ctx->compositing_mode = mode;
+}
+
+// How many pixels to cut from the edge of a row at the given distance from a rounded corner.
+static int corner_inset(int radius, int distance) {
+  int inset = 0;
+  int dy = radius - distance;
+  while (inset < radius && (radius - inset - 1) * (radius - inset - 1) + dy * dy > radius * radius) {
+    ++inset;
+  }
+  return inset;
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+  if (ctx->fill_color.a == 0) {
+    return;
+  }
+  count(OP_FILLS);
+  GRect target = rect;
+  target.origin.x += ctx->offset.x;
+  target.origin.y += ctx->offset.y;
+  GRect clipped = screen_rect(ctx, rect);
+  overwrite_shown_texts(clipped);
+  int radius = corner_mask ? corner_radius : 0;
+  if (radius * 2 > target.size.w) {
+    radius = target.size.w / 2;
+  }
+  if (radius * 2 > target.size.h) {
+    radius = target.size.h / 2;
+  }
+  for (int y = clipped.origin.y; y < clipped.origin.y + clipped.size.h; ++y) {
+    int from_top = y - target.origin.y;
+    int from_bottom = target.origin.y + target.size.h - 1 - y;
+    int left_inset = 0;
+    int right_inset = 0;
+    if (from_top < radius) {
+      left_inset = corner_mask & GCornerTopLeft ? corner_inset(radius, from_top) : 0;
+      right_inset = corner_mask & GCornerTopRight ? corner_inset(radius, from_top) : 0;
+    } else if (from_bottom < radius) {
+      left_inset = corner_mask & GCornerBottomLeft ? corner_inset(radius, from_bottom) : 0;
+      right_inset = corner_mask & GCornerBottomRight ? corner_inset(radius, from_bottom) : 0;
+    }
+    for (int x = clipped.origin.x; x < clipped.origin.x + clipped.size.w; ++x) {
+      if (x >= target.origin.x + left_inset && x < target.origin.x + target.size.w - right_inset) {
+        put_pixel(ctx, x, y, ctx->fill_color);
+      }
+    }
+  }
+}
+
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+  count(OP_BLITS);
+  GRect target = rect;
+  target.origin.x += ctx->offset.x;
+  target.origin.y += ctx->offset.y;
+  GRect clipped = screen_rect(ctx, rect);
+  overwrite_shown_texts(clipped);
+  const GRect *bounds = &bitmap->bounds;
+  if (bounds->size.w <= 0 || bounds->size.h <= 0) {
+    return;
+  }
+  for (int y = clipped.origin.y; y < clipped.origin.y + clipped.size.h; ++y) {
+    // Like the SDK, the bitmap is tiled if the rectangle is larger than it.
+    int source_y = bounds->origin.y + (y - target.origin.y) % bounds->size.h;
+    for (int x = clipped.origin.x; x < clipped.origin.x + clipped.size.w; ++x) {
+      int source_x = bounds->origin.x + (x - target.origin.x) % bounds->size.w;
+      GColor8 color = gbitmap_pixel(bitmap, source_x, source_y);
+      if (ctx->compositing_mode == GCompOpSet && color.a < 2) {
+        continue;
+      }
+      // Like the SDK, 1-bit bitmaps drawn with GCompOpOr only draw their white pixels.
+      if (ctx->compositing_mode == GCompOpOr && bitmap->format == GBitmapFormat1Bit
+       && gcolor_equal(color, GColorBlack)) {
+        continue;
+      }
+      color.a = 3;
+      put_pixel(ctx, x, y, color);
+    }
+  }
+}
+
+// Call the function for each glyph of the text laid out in the box.
+// The function gets the screen position of the glyph bitmap, which is loaded in the font's face.
+static void layout_text(GContext *ctx, const char *text, GFont font, GRect box, GTextAlignment alignment,
+                        void (*glyph_function)(GContext *ctx, GFont font, int x, int y, void *data),
+                        void *data) {
+  int line_top = box.origin.y;
+  for (const char *line = text; *line; ) {
+    int x = box.origin.x;
+    if (alignment != GTextAlignmentLeft) {
+      int slack = box.size.w - line_width(font, line);
+      x += alignment == GTextAlignmentCenter ? slack / 2 : slack;
+    }
+    const char *c = line;
+    for (; *c && *c != '\n'; ++c) {
+      if (!load_glyph(font, *c)) {
+        continue;
+      }
+      FT_GlyphSlot glyph = font->face->glyph;
+      glyph_function(ctx, font, x + glyph->bitmap_left, line_top + font->ascender - glyph->bitmap_top, data);
+      x += glyph->advance.x >> 6;
+    }
+    line_top += font->line_height;
+    line = *c ? c + 1 : c;
+  }
+}
+
+// Draw the glyph loaded in the font's face, clipped to the box passed as the data.
+static void draw_glyph(GContext *ctx, GFont font, int x, int y, void *data) {
+  GRect clip = *(GRect *)data;
+  const FT_Bitmap *bitmap = &font->face->glyph->bitmap;
+  for (unsigned int row = 0; row < bitmap->rows; ++row) {
+    int screen_y = y + row;
+    if (screen_y < clip.origin.y || screen_y >= clip.origin.y + clip.size.h) {
+      continue;
+    }
+    for (unsigned int column = 0; column < bitmap->width; ++column) {
+      int screen_x = x + column;
+      if (screen_x < clip.origin.x || screen_x >= clip.origin.x + clip.size.w) {
+        continue;
+      }
+      if (bitmap->buffer[row * bitmap->pitch + column / 8] & (0x80 >> (column % 8))) {
+        put_pixel(ctx, screen_x, screen_y, ctx->text_color);
+      }
+    }
+  }
+}
+
+// Extend the rectangle passed as the data to cover the glyph loaded in the font's face.
+static void cover_glyph(GContext *ctx, GFont font, int x, int y, void *data) {
+  GRect *ink = data;
+  const FT_Bitmap *bitmap = &font->face->glyph->bitmap;
+  if (!bitmap->width || !bitmap->rows) {
+    return;
+  }
+  if (!ink->size.w) {
+    *ink = GRect(x, y, bitmap->width, bitmap->rows);
+    return;
+  }
+  int right = ink->origin.x + ink->size.w > x + (int)bitmap->width ? ink->origin.x + ink->size.w : x + (int)bitmap->width;
+  int bottom = ink->origin.y + ink->size.h > y + (int)bitmap->rows ? ink->origin.y + ink->size.h : y + (int)bitmap->rows;
+  ink->origin.x = ink->origin.x < x ? ink->origin.x : x;
+  ink->origin.y = ink->origin.y < y ? ink->origin.y : y;
+  ink->size.w = right - ink->origin.x;
+  ink->size.h = bottom - ink->origin.y;
+}
+
+// Remember a text was drawn at the screen position, for logging the display changes.
+static void show_text(GPoint origin, GRect ink, const char *text) {
+  ShownText *shown = NULL;
+  for (int index = 0; index < SHOWN_TEXTS && !shown; ++index) {
+    if (shown_texts[index].origin.x == origin.x && shown_texts[index].origin.y == origin.y) {
+      shown = &shown_texts[index];
+    }
+  }
+  for (int index = 0; index < SHOWN_TEXTS && !shown; ++index) {
+    if (!shown_texts[index].is_visible) {
+      shown = &shown_texts[index];
+    }
+  }
+  if (!shown) {
+    return;
+  }
+  shown->origin = origin;
+  shown->ink = ink;
+  snprintf(shown->text, sizeof(shown->text), "%s", text);
+  shown->is_visible = ink.size.w > 0;
+}
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+                        const GTextOverflowMode overflow_mode, const GTextAlignment alignment,
+                        GTextAttributes *text_attributes) {
+  count(OP_DRAW_TEXT);
+  GRect target = box;
+  target.origin.x += ctx->offset.x;
+  target.origin.y += ctx->offset.y;
+  GRect clipped = screen_rect(ctx, box);
+  GRect ink = GRectZero;
+  layout_text(ctx, text, font, target, alignment, cover_glyph, &ink);
+  grect_clip(&ink, &clipped);
+  overwrite_shown_texts(ink);
+  if (ctx->text_color.a) {
+    layout_text(ctx, text, font, target, alignment, draw_glyph, &clipped);
+  }
+  show_text(target.origin, ink, text);
+}
+
+GSize graphics_text_layout_get_content_size(const char *text, GFont const font, const GRect box,
+                                            const GTextOverflowMode overflow_mode,
+                                            const GTextAlignment alignment) {
+  int width = 0;
+  int lines = 0;
+  for (const char *line = text; *line; ++lines) {
+    int this_width = line_width(font, line);
+    width = this_width > width ? this_width : width;
+    line = strchr(line, '\n') ? strchr(line, '\n') + 1 : line + strlen(line);
+  }
+  int height = lines * font->line_height;
+  return GSize(width < box.size.w ? width : box.size.w, height < box.size.h ? height : box.size.h);
+}
+
+// The captured frame buffer, while the watchface holds it.
+static GBitmap frame_buffer_bitmap;
+
+#ifdef PBL_BW
+// The aplite frame buffer has a bit per pixel, so the watchface gets a 1-bit copy of ours (only
+// reading it, so nothing is copied back on release).
+static uint8_t frame_buffer_bits[HOST_SCREEN_HEIGHT][(HOST_SCREEN_WIDTH + 31) / 32 * 4];
+#endif
+
+GBitmap *graphics_capture_frame_buffer(GContext *ctx) {
+  if (frame_buffer_bitmap.data) {
+    return NULL;
+  }
+  frame_buffer_bitmap.size = GSize(HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+  frame_buffer_bitmap.bounds = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+#ifdef PBL_BW
+  memset(frame_buffer_bits, 0, sizeof(frame_buffer_bits));
+  for (int y = 0; y < HOST_SCREEN_HEIGHT; ++y) {
+    for (int x = 0; x < HOST_SCREEN_WIDTH; ++x) {
+      if (gcolor_equal(host->framebuffer[y][x], GColorWhite)) {
+        frame_buffer_bits[y][x / 8] |= 1 << (x % 8);
+      }
+    }
+  }
+  frame_buffer_bitmap.format = GBitmapFormat1Bit;
+  frame_buffer_bitmap.bytes_per_row = sizeof(frame_buffer_bits[0]);
+  frame_buffer_bitmap.data = &frame_buffer_bits[0][0];
+#else
+  frame_buffer_bitmap.format = GBitmapFormat8Bit;
+  frame_buffer_bitmap.bytes_per_row = sizeof(host->framebuffer[0]);
+  frame_buffer_bitmap.data = (uint8_t *)host->framebuffer;
+#endif
+  return &frame_buffer_bitmap;
+}
+
+bool graphics_release_frame_buffer(GContext *ctx, GBitmap *buffer) {
+  if (buffer != &frame_buffer_bitmap || !frame_buffer_bitmap.data) {
+    return false;
+  }
+  frame_buffer_bitmap.data = NULL;
+  return true;
+}
+
+//// Layers.
+
+// The kinds of layers.
+typedef enum {
+  PLAIN_LAYER,
+  TEXT_LAYER,
+  BITMAP_LAYER,
+} LayerKind;
+
+struct Layer {
+  LayerKind kind;
+  GRect frame;
+  bool is_hidden;
+  LayerUpdateProc update_proc;
+  Layer *parent;
+  Layer *first_child;
+  Layer *next_sibling;
+  void *data;
+};
+
+struct TextLayer {
+  Layer layer;
+  const char *text;
+  GColor text_color;
+  GColor background_color;
+  GFont font;
+};
+
+struct BitmapLayer {
+  Layer layer;
+  const GBitmap *bitmap;
+  GColor background_color;
+};
+
+static void layer_init(Layer *layer, LayerKind kind, GRect frame) {
+  layer->kind = kind;
+  layer->frame = frame;
+}
+
+Layer *layer_create(GRect frame) {
+  Layer *layer = heap_calloc(sizeof(Layer));
+  layer_init(layer, PLAIN_LAYER, frame);
+  return layer;
+}
+
+Layer *layer_create_with_data(GRect frame, size_t data_size) {
+  Layer *layer = layer_create(frame);
+  layer->data = heap_calloc(data_size);
+  return layer;
+}
+
+void *layer_get_data(const Layer *layer) {
+  return layer->data;
+}
+
+void layer_destroy(Layer *layer) {
+  layer_remove_from_parent(layer);
+  heap_free(layer->data);
+  heap_free(layer);
+}
+
+void layer_mark_dirty(Layer *layer) {
+  count(OP_LAYER_MARK_DIRTY);
+  invalidate();
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+  layer->update_proc = update_proc;
+}
+
+GRect layer_get_frame(const Layer *layer) {
+  return layer->frame;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+  layer->frame = frame;
+  invalidate();
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+  return GRect(0, 0, layer->frame.size.w, layer->frame.size.h);
+}
+
+GRect layer_get_unobstructed_bounds(const Layer *layer) {
+  GPoint origin = layer->frame.origin;
+  for (const Layer *parent = layer->parent; parent; parent = parent->parent) {
+    origin.x += parent->frame.origin.x;
+    origin.y += parent->frame.origin.y;
+  }
+  GRect bounds = layer_get_bounds(layer);
+  GRect unobstructed = GRect(-origin.x, -origin.y, HOST_SCREEN_WIDTH,
+                             HOST_SCREEN_HEIGHT - host->obstruction_height);
+  grect_clip(&bounds, &unobstructed);
+  return bounds;
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+  layer_remove_from_parent(child);
+  child->parent = parent;
+  Layer **link = &parent->first_child;
+  while (*link) {
+    link = &(*link)->next_sibling;
+  }
+  *link = child;
+  invalidate();
+}
+
+void layer_remove_from_parent(Layer *child) {
+  if (!child->parent) {
+    return;
+  }
+  Layer **link = &child->parent->first_child;
+  while (*link != child) {
+    link = &(*link)->next_sibling;
+  }
+  *link = child->next_sibling;
+  child->parent = NULL;
+  child->next_sibling = NULL;
+  invalidate();
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+  if (layer->is_hidden == hidden) {
+    return;
+  }
+  count(OP_LAYER_SET_HIDDEN);
+  layer->is_hidden = hidden;
+  invalidate();
+}
+
+bool layer_get_hidden(const Layer *layer) {
+  return layer->is_hidden;
+}
+
+TextLayer *text_layer_create(GRect frame) {
+  TextLayer *text_layer = heap_calloc(sizeof(TextLayer));
+  layer_init(&text_layer->layer, TEXT_LAYER, frame);
+  text_layer->text_color = GColorBlack;
+  text_layer->background_color = GColorWhite;
+  return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+  layer_remove_from_parent(&text_layer->layer);
+  heap_free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer) {
+  return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+  text_layer->text = text;
+  invalidate();
+}
+
+const char *text_layer_get_text(TextLayer *text_layer) {
+  return text_layer->text;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) {
+  text_layer->background_color = color;
+  invalidate();
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) {
+  text_layer->text_color = color;
+  invalidate();
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+  text_layer->font = font;
+  invalidate();
+}
+
+static void render_text_layer(TextLayer *text_layer, GContext *ctx) {
+  GRect bounds = layer_get_bounds(&text_layer->layer);
+  graphics_context_set_fill_color(ctx, text_layer->background_color);
+  graphics_fill_rect(ctx, bounds, 0, GCornerNone);
+  if (text_layer->text && text_layer->font) {
+    graphics_context_set_text_color(ctx, text_layer->text_color);
+    graphics_draw_text(ctx, text_layer->text, text_layer->font, bounds,
+                       GTextOverflowModeWordWrap, GTextAlignmentLeft, NULL);
+  }
+}
+
+BitmapLayer *bitmap_layer_create(GRect frame) {
+  BitmapLayer *bitmap_layer = heap_calloc(sizeof(BitmapLayer));
+  layer_init(&bitmap_layer->layer, BITMAP_LAYER, frame);
+  bitmap_layer->background_color = GColorClear;
+  return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) {
+  layer_remove_from_parent(&bitmap_layer->layer);
+  heap_free(bitmap_layer);
+}
+
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) {
+  return (Layer *)&bitmap_layer->layer;
+}
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) {
+  bitmap_layer->bitmap = bitmap;
+  invalidate();
+}
+
+static void render_bitmap_layer(BitmapLayer *bitmap_layer, GContext *ctx) {
+  GRect bounds = layer_get_bounds(&bitmap_layer->layer);
+  graphics_context_set_fill_color(ctx, bitmap_layer->background_color);
+  graphics_fill_rect(ctx, bounds, 0, GCornerNone);
+  if (bitmap_layer->bitmap) {
+    // Like the SDK default (GAlignCenter).
+    GSize size = bitmap_layer->bitmap->bounds.size;
+    GRect rect = GRect((bounds.size.w - size.w) / 2, (bounds.size.h - size.h) / 2, size.w, size.h);
+    graphics_draw_bitmap_in_rect(ctx, bitmap_layer->bitmap, rect);
+  }
+}
+
+//// Windows.
+
+struct Window {
+  Layer root_layer;
+  GColor background_color;
+  WindowHandlers handlers;
+};
+
+// The window on top of the stack, which is the one we render.
+static Window *top_window;
+
+Window *window_create(void) {
+  Window *window = heap_calloc(sizeof(Window));
+  layer_init(&window->root_layer, PLAIN_LAYER, GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT));
+  window->background_color = GColorWhite;
+  return window;
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+  window->handlers = handlers;
+}
+
+void window_destroy(Window *window) {
+  if (top_window == window) {
+    if (window->handlers.disappear) {
+      window->handlers.disappear(window);
+    }
+    if (window->handlers.unload) {
+      window->handlers.unload(window);
+    }
+    top_window = NULL;
+  }
+  heap_free(window);
+}
+
+void window_stack_push(Window *window, bool animated) {
+  top_window = window;
+  if (window->handlers.load) {
+    window->handlers.load(window);
+  }
+  if (window->handlers.appear) {
+    window->handlers.appear(window);
+  }
+  invalidate();
+}
+
+Layer *window_get_root_layer(const Window *window) {
+  return (Layer *)&window->root_layer;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+  window->background_color = background_color;
+  invalidate();
+}
+
+//// Rendering.
+
+// Fill the rows of the frame buffer from the top one down with garbage.
+static void trash_rows(int top) {
+  for (int y = top; y < HOST_SCREEN_HEIGHT; ++y) {
+    for (int x = 0; x < HOST_SCREEN_WIDTH; ++x) {
+      host->framebuffer[y][x] = (GColor8){ .argb = (x ^ y) & 4 ? 0xF3 /* Magenta */ : 0xCF /* Cyan */ };
+    }
+  }
+}
+
+// Fill the frame buffer with garbage, which the watchface must fully draw over.
+static void trash_framebuffer(void) {
+  trash_rows(0);
+  memset(shown_texts, 0, sizeof(shown_texts));
+}
+
+static void render_layer(Layer *layer, GPoint offset, GRect clip) {
+  if (layer->is_hidden) {
+    return;
+  }
+  GRect frame = layer->frame;
+  frame.origin.x += offset.x;
+  frame.origin.y += offset.y;
+  grect_clip(&clip, &frame);
+  // Like the SDK, the drawing state is reset for each layer.
+  GContext ctx = { .offset = frame.origin, .clip = clip, .fill_color = GColorBlack,
+                   .text_color = GColorBlack, .compositing_mode = GCompOpAssign };
+  switch (layer->kind) {
+    case TEXT_LAYER:
+      render_text_layer((TextLayer *)layer, &ctx);
+      break;
+    case BITMAP_LAYER:
+      render_bitmap_layer((BitmapLayer *)layer, &ctx);
+      break;
+    case PLAIN_LAYER:
+      if (layer->update_proc) {
+        layer->update_proc(layer, &ctx);
+      }
+      break;
+  }
+  for (Layer *child = layer->first_child; child; child = child->next_sibling) {
+    render_layer(child, frame.origin, clip);
+  }
+}
+
+// The last logged display, to only log changes.
+static char last_display[1024];
+
+static int compare_shown_texts(const void *left, const void *right) {
+  const ShownText *shown_left = left;
+  const ShownText *shown_right = right;
+  if (shown_left->is_visible != shown_right->is_visible) {
+    return shown_right->is_visible - shown_left->is_visible;
+  }
+  if (shown_left->origin.y != shown_right->origin.y) {
+    return shown_left->origin.y - shown_right->origin.y;
+  }
+  return shown_left->origin.x - shown_right->origin.x;
+}
+
+// Log the frame buffer checksum and the visible texts (top to bottom), if they changed.
+static void log_display(void) {
+  char display[sizeof(last_display)];
+  snprintf(display, sizeof(display), "%08lx",
+           crc32(0, (const Bytef *)host->framebuffer, sizeof(host->framebuffer)));
+  ShownText sorted[SHOWN_TEXTS];
+  memcpy(sorted, shown_texts, sizeof(sorted));
+  qsort(sorted, SHOWN_TEXTS, sizeof(ShownText), compare_shown_texts);
+  for (int index = 0; index < SHOWN_TEXTS && sorted[index].is_visible; ++index) {
+    size_t used = strlen(display);
+    snprintf(display + used, sizeof(display) - used, " [%s]", sorted[index].text);
+  }
+  if (strcmp(display, last_display)) {
+    strcpy(last_display, display);
+    for (char *c = display; *c; ++c) {
+      if (*c == '\n') {
+        *c = '/';
+      }
+    }
+    log_prefix();
+    printf("display %s\n", display);
+  }
+}
+
+static void render_frame(void) {
+  if (!top_window) {
+    return;
+  }
+  GRect screen = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT);
+  GContext ctx = { .clip = screen, .fill_color = top_window->background_color };
+  graphics_fill_rect(&ctx, screen, 0, GCornerNone);
+  render_layer(&top_window->root_layer, GPoint(0, 0), screen);
+  // The system draws the timeline peek over the bottom of whatever the watchface drew, and the
+  // watchface must draw these rows again once it slides away.
+  if (host->obstruction_height) {
+    int top = HOST_SCREEN_HEIGHT - host->obstruction_height;
+    trash_rows(top);
+    overwrite_shown_texts(GRect(0, top, HOST_SCREEN_WIDTH, host->obstruction_height));
+  }
+  if (host->is_logging) {
+    log_display();
+  }
+}
+
+typedef uint8_t HostRGB[HOST_SCREEN_HEIGHT][HOST_SCREEN_WIDTH][3];
+
+static void framebuffer_rgb(HostRGB rgb) {
+  for (int y = 0; y < HOST_SCREEN_HEIGHT; ++y) {
+    for (int x = 0; x < HOST_SCREEN_WIDTH; ++x) {
+      GColor8 color = host->framebuffer[y][x];
+      rgb[y][x][0] = color.r * 85;
+      rgb[y][x][1] = color.g * 85;
+      rgb[y][x][2] = color.b * 85;
+    }
+  }
+}
+
+void host_write_framebuffer(const char *path) {
+  HostRGB rgb;
+  framebuffer_rgb(rgb);
+  png_image image = { .version = PNG_IMAGE_VERSION, .width = HOST_SCREEN_WIDTH,
+                      .height = HOST_SCREEN_HEIGHT, .format = PNG_FORMAT_RGB };
+  if (!png_image_write_to_file(&image, path, 0, rgb, 0, NULL)) {
+    fprintf(stderr, "%s: %s\n", path, image.message);
+    exit(2);
+  }
+}
+
+int host_compare_framebuffer(const char *path, GRect *difference) {
+  png_image image = { .version = PNG_IMAGE_VERSION };
+  if (!png_image_begin_read_from_file(&image, path)) {
+    return -1;
+  }
+  if (image.width != HOST_SCREEN_WIDTH || image.height != HOST_SCREEN_HEIGHT) {
+    png_image_free(&image);
+    return -1;
+  }
+  image.format = PNG_FORMAT_RGB;
+  HostRGB expected;
+  if (!png_image_finish_read(&image, NULL, expected, 0, NULL)) {
+    return -1;
+  }
+  HostRGB actual;
+  framebuffer_rgb(actual);
+  int differences = 0;
+  int left = HOST_SCREEN_WIDTH, top = HOST_SCREEN_HEIGHT, right = 0, bottom = 0;
+  for (int y = 0; y < HOST_SCREEN_HEIGHT; ++y) {
+    for (int x = 0; x < HOST_SCREEN_WIDTH; ++x) {
+      if (memcmp(expected[y][x], actual[y][x], sizeof(actual[y][x]))) {
+        ++differences;
+        left = x < left ? x : left;
+        top = y < top ? y : top;
+        right = x + 1 > right ? x + 1 : right;
+        bottom = y + 1 > bottom ? y + 1 : bottom;
+      }
+    }
+  }
+  *difference = differences ? GRect(left, top, right - left, bottom - top) : GRectZero;
+  return differences;
+}
+
+//// Time.
+
+// The subscribed tick handler, if any.
+static TickHandler tick_handler;
+
+// The units we subscribed to.
+static TimeUnits tick_units;
+
+// The time of the last tick.
+static int64_t last_tick_ms;
+
+void tick_timer_service_subscribe(TimeUnits units, TickHandler handler) {
+  tick_units = units;
+  tick_handler = handler;
+  last_tick_ms = host->now_ms;
+}
+
+void tick_timer_service_unsubscribe(void) {
+  tick_handler = NULL;
+}
+
+bool clock_is_24h_style(void) {
+  return host->is_24h_style;
+}
+
+time_t host_time(time_t *timer) {
+  time_t now = host->now_ms / 1000;
+  if (timer) {
+    *timer = now;
+  }
+  return now;
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+  uint16_t ms = host->now_ms % 1000;
+  host_time(tloc);
+  if (out_ms) {
+    *out_ms = ms;
+  }
+  return ms;
+}
+
+// The time of the next tick, if we are subscribed.
+static int64_t next_tick_ms(void) {
+  int64_t unit_ms = tick_units & SECOND_UNIT ? 1000
+                  : tick_units & MINUTE_UNIT ? 60 * 1000
+                  : tick_units & HOUR_UNIT ? 3600 * 1000
+                  : 86400 * 1000;
+  return (last_tick_ms / unit_ms + 1) * unit_ms;
+}
+
+static void dispatch_tick(void) {
+  time_t last_time = last_tick_ms / 1000;
+  struct tm last_tm = *localtime(&last_time);
+  time_t now = host->now_ms / 1000;
+  struct tm now_tm = *localtime(&now);
+  last_tick_ms = host->now_ms;
+
+  TimeUnits units_changed = 0;
+  if (last_tm.tm_sec != now_tm.tm_sec) {
+    units_changed |= SECOND_UNIT;
+  }
+  if (last_tm.tm_min != now_tm.tm_min) {
+    units_changed |= MINUTE_UNIT;
+  }
+  if (last_tm.tm_hour != now_tm.tm_hour) {
+    units_changed |= HOUR_UNIT;
+  }
+  if (last_tm.tm_mday != now_tm.tm_mday) {
+    units_changed |= DAY_UNIT;
+  }
+  if (last_tm.tm_mon != now_tm.tm_mon) {
+    units_changed |= MONTH_UNIT;
+  }
+  if (last_tm.tm_year != now_tm.tm_year) {
+    units_changed |= YEAR_UNIT;
+  }
+  if (!(units_changed & tick_units)) {
+    return;
+  }
+
+  begin_handler(units_changed & DAY_UNIT ? HANDLER_DAY_TICK
+              : units_changed & (MINUTE_UNIT | HOUR_UNIT) ? HANDLER_MINUTE_TICK
+              : HANDLER_SECOND_TICK);
+  tick_handler(&now_tm, units_changed);
+  end_handler();
+}
+
+//// Battery.
+
+static BatteryStateHandler battery_handler;
+
+BatteryChargeState battery_state_service_peek(void) {
+  return host->battery;
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) {
+  battery_handler = handler;
+}
+
+void battery_state_service_unsubscribe(void) {
+  battery_handler = NULL;
+}
+
+static void dispatch_battery(BatteryChargeState battery) {
+  host->battery = battery;
+  if (battery_handler) {
+    begin_handler(HANDLER_BATTERY);
+    battery_handler(battery);
+    end_handler();
+  }
+}
+
+//// Bluetooth.
+
+static BluetoothConnectionHandler bluetooth_handler;
+
+bool bluetooth_connection_service_peek(void) {
+  return host->is_bluetooth_connected;
+}
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {
+  bluetooth_handler = handler;
+}
+
+void bluetooth_connection_service_unsubscribe(void) {
+  bluetooth_handler = NULL;
+}
+
+static void dispatch_bluetooth(bool is_connected) {
+  if (is_connected == host->is_bluetooth_connected) {
+    return;
+  }
+  host->is_bluetooth_connected = is_connected;
+  if (bluetooth_handler) {
+    begin_handler(HANDLER_BLUETOOTH);
+    bluetooth_handler(is_connected);
+    end_handler();
+  }
+}
+
+//// Compass.
+
+static CompassHeadingHandler compass_handler;
+
+// When we last accounted for the compass being on.
+static int64_t compass_on_since_ms;
+
+// The minimal heading change for delivering a new sample.
+static CompassHeading compass_filter;
+
+// The last delivered sample.
+static CompassHeadingData last_compass;
+
+// Whether we delivered any sample since subscribing.
+static bool was_compass_delivered;
+
+int compass_service_set_heading_filter(CompassHeading filter) {
+  compass_filter = filter;
+  return S_SUCCESS;
+}
+
+// Add the time the compass was on since we last did so.
+static void account_compass_on(void) {
+  if (compass_handler) {
+    host->compass_on_ms += host->now_ms - compass_on_since_ms;
+  }
+  compass_on_since_ms = host->now_ms;
+}
+
+void compass_service_subscribe(CompassHeadingHandler handler) {
+  account_compass_on();
+  compass_handler = handler;
+  was_compass_delivered = false;
+}
+
+void compass_service_unsubscribe(void) {
+  account_compass_on();
+  compass_handler = NULL;
+}
+
+static void dispatch_compass(CompassStatus status, int degrees) {
+  if (!compass_handler) {
+    return;
+  }
+  CompassHeadingData heading = {
+    .magnetic_heading = DEG_TO_TRIGANGLE(degrees),
+    .true_heading = DEG_TO_TRIGANGLE(degrees),
+    .compass_status = status,
+    .is_declination_valid = true,
+  };
+  if (was_compass_delivered && status == last_compass.compass_status) {
+    CompassHeading delta = heading.true_heading - last_compass.true_heading;
+    if (delta < 0) {
+      delta = -delta;
+    }
+    if (delta > TRIG_MAX_ANGLE / 2) {
+      delta = TRIG_MAX_ANGLE - delta;
+    }
+    if (delta < compass_filter) {
+      return;
+    }
+  }
+  was_compass_delivered = true;
+  last_compass = heading;
+  begin_handler(HANDLER_COMPASS);
+  compass_handler(heading);
+  end_handler();
+}
+
+//// Accelerometer.
+
+static AccelTapHandler tap_handler;
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+  tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+  tap_handler = NULL;
+}
+
+static void dispatch_tap(void) {
+  if (!tap_handler) {
+    return;
+  }
+  begin_handler(HANDLER_TAP);
+  tap_handler(ACCEL_AXIS_X, 1);
+  end_handler();
+}
+
+//// Health.
+
+#ifdef PBL_HEALTH
+static HealthEventHandler health_handler;
+static void *health_context;
+
+bool health_service_events_subscribe(HealthEventHandler handler, void *context) {
+  health_handler = handler;
+  health_context = context;
+  return true;
+}
+
+bool health_service_events_unsubscribe(void) {
+  health_handler = NULL;
+  return true;
+}
+
+HealthActivityMask health_service_peek_current_activities(void) {
+  return host->is_asleep ? HealthActivitySleep : HealthActivityNone;
+}
+
+static void dispatch_health(HealthEventType event) {
+  if (!health_handler) {
+    return;
+  }
+  begin_handler(HANDLER_HEALTH);
+  health_handler(event, health_context);
+  end_handler();
+}
+
+static void dispatch_sleep(bool is_asleep) {
+  if (is_asleep == host->is_asleep) {
+    return;
+  }
+  host->is_asleep = is_asleep;
+  dispatch_health(HealthEventSleepUpdate);
+}
+
+static void dispatch_movement(void) {
+  dispatch_health(HealthEventMovementUpdate);
+}
+#else
+// Aplite has no Health service, so its traces' movement and sleep events do nothing.
+static void dispatch_sleep(bool is_asleep) {
+  host->is_asleep = is_asleep;
+}
+
+static void dispatch_movement(void) {
+}
+#endif
+
+//// App focus.
+
+static AppFocusHandlers focus_handlers;
+
+void app_focus_service_subscribe_handlers(AppFocusHandlers handlers) {
+  focus_handlers = handlers;
+}
+
+void app_focus_service_unsubscribe(void) {
+  focus_handlers = (AppFocusHandlers){ NULL, NULL };
+}
+
+static void call_focus_handlers(bool in_focus) {
+  if (focus_handlers.will_focus) {
+    focus_handlers.will_focus(in_focus);
+  }
+  if (focus_handlers.did_focus) {
+    focus_handlers.did_focus(in_focus);
+  }
+}
+
+static void dispatch_notification(void) {
+  begin_handler(HANDLER_FOCUS);
+  call_focus_handlers(false);
+  trash_framebuffer();
+  call_focus_handlers(true);
+  // The system renders the window again when the notification goes away.
+  invalidate();
+  end_handler();
+}
+
+//// Unobstructed area.
+
+// The height of a timeline peek, and how many frames it takes to slide in or out.
+#define HOST_PEEK_HEIGHT 51
+#define HOST_PEEK_FRAMES 8
+
+static UnobstructedAreaHandlers unobstructed_area_handlers;
+static void *unobstructed_area_context;
+
+void unobstructed_area_service_subscribe(UnobstructedAreaHandlers handlers, void *context) {
+  unobstructed_area_handlers = handlers;
+  unobstructed_area_context = context;
+}
+
+void unobstructed_area_service_unsubscribe(void) {
+  unobstructed_area_handlers = (UnobstructedAreaHandlers){ NULL, NULL, NULL };
+}
+
+// Each frame of the animation is a separate handler call, and the system renders the window in
+// each of them (whether or not the watchface is subscribed).
+static void dispatch_peek(bool is_shown) {
+#ifdef PBL_PLATFORM_APLITE
+  // Aplite has no timeline peeks.
+  return;
+#endif
+  int from_height = host->obstruction_height;
+  int to_height = is_shown ? HOST_PEEK_HEIGHT : 0;
+  if (from_height == to_height) {
+    return;
+  }
+  for (int frame = 1; frame <= HOST_PEEK_FRAMES; ++frame) {
+    begin_handler(HANDLER_PEEK);
+    if (frame == 1 && unobstructed_area_handlers.will_change) {
+      GRect final_area = GRect(0, 0, HOST_SCREEN_WIDTH, HOST_SCREEN_HEIGHT - to_height);
+      unobstructed_area_handlers.will_change(final_area, unobstructed_area_context);
+    }
+    host->obstruction_height = from_height + (to_height - from_height) * frame / HOST_PEEK_FRAMES;
+    if (unobstructed_area_handlers.change) {
+      unobstructed_area_handlers.change(ANIMATION_NORMALIZED_MAX * frame / HOST_PEEK_FRAMES,
+                                        unobstructed_area_context);
+    }
+    if (frame == HOST_PEEK_FRAMES && unobstructed_area_handlers.did_change) {
+      unobstructed_area_handlers.did_change(unobstructed_area_context);
+    }
+    invalidate();
+    end_handler();
+  }
+}
+
+//// Persistent storage.
+
+static HostPersist *find_persist(uint32_t key) {
+  for (int index = 0; index < HOST_PERSIST_KEYS; ++index) {
+    if (host->persist[index].is_used && host->persist[index].key == key) {
+      return &host->persist[index];
+    }
+  }
+  return NULL;
+}
+
+bool persist_exists(const uint32_t key) {
+  count(OP_PERSIST_EXISTS);
+  return find_persist(key) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+  count(OP_PERSIST_EXISTS);
+  HostPersist *persist = find_persist(key);
+  return persist ? persist->size : E_DOES_NOT_EXIST;
+}
+
+bool persist_read_bool(const uint32_t key) {
+  bool value = false;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+  count(OP_PERSIST_READ);
+  HostPersist *persist = find_persist(key);
+  if (!persist) {
+    return E_DOES_NOT_EXIST;
+  }
+  size_t size = persist->size < buffer_size ? persist->size : buffer_size;
+  memcpy(buffer, persist->data, size);
+  return size;
+}
+
+status_t persist_write_bool(const uint32_t key, const bool value) {
+  int written = persist_write_data(key, &value, sizeof(value));
+  return written < 0 ? written : S_SUCCESS;
+}
+
+status_t persist_write_int(const uint32_t key, const int32_t value) {
+  int written = persist_write_data(key, &value, sizeof(value));
+  return written < 0 ? written : S_SUCCESS;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+  count(OP_PERSIST_WRITE);
+  if (size > PERSIST_DATA_MAX_LENGTH) {
+    return E_RANGE;
+  }
+  HostPersist *persist = find_persist(key);
+  for (int index = 0; !persist && index < HOST_PERSIST_KEYS; ++index) {
+    if (!host->persist[index].is_used) {
+      persist = &host->persist[index];
+    }
+  }
+  if (!persist) {
+    return E_OUT_OF_STORAGE;
+  }
+  persist->is_used = true;
+  persist->key = key;
+  persist->size = size;
+  memcpy(persist->data, data, size);
+  return size;
+}
+
+status_t persist_delete(const uint32_t key) {
+  count(OP_PERSIST_WRITE);
+  HostPersist *persist = find_persist(key);
+  if (!persist) {
+    return E_DOES_NOT_EXIST;
+  }
+  persist->is_used = false;
+  return S_SUCCESS;
+}
+
+//// Formatting.
+
+int host_snprintf(char *str, size_t size, const char *format, ...) {
+  count(OP_SNPRINTF);
+  va_list args;
+  va_start(args, format);
+  int result = vsnprintf(str, size, format, args);
+  va_end(args);
+  return result;
+}
+
+size_t host_strftime(char *s, size_t max, const char *format, const struct tm *tm) {
+  count(OP_STRFTIME);
+  return strftime(s, max, format, tm);
+}
+
+//// Data logging.
+
+// The items of all sessions are appended to the same file, as they are logged (a real session
+// buffers them on the watch until the phone collects them).
+typedef struct {
+  uint16_t item_length;
+  int fd;
+} HostDataLoggingSession;
+
+DataLoggingSessionRef data_logging_create(uint32_t tag, DataLoggingItemType item_type, uint16_t item_length,
+                                          bool resume) {
+  HostDataLoggingSession *session = malloc(sizeof(HostDataLoggingSession));
+  session->item_length = item_length;
+  session->fd = -1;
+  if (host->data_logging_path[0]) {
+    session->fd = open(host->data_logging_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (session->fd < 0) {
+      perror(host->data_logging_path);
+      exit(1);
+    }
+  }
+  return session;
+}
+
+DataLoggingResult data_logging_log(DataLoggingSessionRef logging_session, const void *data, uint32_t num_items) {
+  count(OP_DATA_LOGGING_LOG);
+  HostDataLoggingSession *session = logging_session;
+  size_t size = (size_t)session->item_length * num_items;
+  if (session->fd >= 0 && write(session->fd, data, size) != (ssize_t)size) {
+    perror(host->data_logging_path);
+    exit(1);
+  }
+  return DATA_LOGGING_SUCCESS;
+}
+
+void data_logging_finish(DataLoggingSessionRef logging_session) {
+  HostDataLoggingSession *session = logging_session;
+  if (session->fd >= 0) {
+    close(session->fd);
+  }
+  free(session);
+}
+
+//// Timers.
+
+// The maximal number of concurrently registered timers.
+#define HOST_TIMERS_COUNT 16
+
+struct AppTimer {
+  bool is_used;
+  int64_t due_ms;
+  AppTimerCallback callback;
+  void *callback_data;
+};
+
+static AppTimer timers[HOST_TIMERS_COUNT];
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+  for (int index = 0; index < HOST_TIMERS_COUNT; ++index) {
+    if (!timers[index].is_used) {
+      timers[index] = (AppTimer){ true, host->now_ms + timeout_ms, callback, callback_data };
+      return &timers[index];
+    }
+  }
+  fprintf(stderr, "too many app timers\n");
+  exit(1);
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+  if (!timer_handle || !timer_handle->is_used) {
+    return false;
+  }
+  timer_handle->due_ms = host->now_ms + new_timeout_ms;
+  return true;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+  if (timer_handle) {
+    timer_handle->is_used = false;
+  }
+}
+
+// The earliest due timer, if any.
+static AppTimer *next_timer(void) {
+  AppTimer *next = NULL;
+  for (int index = 0; index < HOST_TIMERS_COUNT; ++index) {
+    if (timers[index].is_used && (!next || timers[index].due_ms < next->due_ms)) {
+      next = &timers[index];
+    }
+  }
+  return next;
+}
+
+static void dispatch_timer(AppTimer *timer) {
+  // The handle becomes invalid once the callback is called, so it may register a new timer.
+  timer->is_used = false;
+  begin_handler(HANDLER_TIMER);
+  timer->callback(timer->callback_data);
+  end_handler();
+}
+
+//// Event loop.
+
+void app_event_loop(void) {
+  end_handler(); // Of HANDLER_INIT.
+  for (;;) {
+    int64_t tick_ms = tick_handler ? next_tick_ms() : INT64_MAX;
+    AppTimer *timer = next_timer();
+    const HostEvent *event = host->next_event < host->events_count ? &host->events[host->next_event] : NULL;
+    if (!event) {
+      host->is_finished = true;
+      break;
+    }
+    if (timer && timer->due_ms <= event->time_ms && timer->due_ms < tick_ms) {
+      host->now_ms = timer->due_ms;
+      dispatch_timer(timer);
+      continue;
+    }
+    if (tick_ms <= event->time_ms) {
+      host->now_ms = tick_ms;
+      dispatch_tick();
+      continue;
+    }
+    host->now_ms = event->time_ms;
+    ++host->next_event;
+    switch (event->kind) {
+      case EVENT_BATTERY:
+        dispatch_battery(event->battery);
+        continue;
+      case EVENT_BLUETOOTH:
+        dispatch_bluetooth(event->is_connected);
+        continue;
+      case EVENT_COMPASS:
+        dispatch_compass(event->compass.status, event->compass.degrees);
+        continue;
+      case EVENT_TAP:
+        dispatch_tap();
+        continue;
+      case EVENT_MOVEMENT:
+        dispatch_movement();
+        continue;
+      case EVENT_SLEEP:
+        dispatch_sleep(event->is_asleep);
+        continue;
+      case EVENT_NOTIFICATION:
+        dispatch_notification();
+        continue;
+      case EVENT_PEEK:
+        dispatch_peek(event->is_peek_shown);
+        continue;
+      case EVENT_RESTART:
+        break;
+      case EVENT_CRASH:
+        account_compass_on();
+        fflush(stdout);
+        _exit(0);
+      case EVENT_END:
+        host->is_finished = true;
+        break;
+    }
+    break;
+  }
+  account_compass_on();
+  begin_handler(HANDLER_DEINIT);
+}
+
+void host_launch(int (*watchface_main)(void)) {
+  ++host->launches;
+  trash_framebuffer();
+  launch_start_ns = monotonic_ns();
+  begin_handler(HANDLER_INIT);
+  watchface_main();
+  end_handler(); // Of HANDLER_DEINIT.
+}
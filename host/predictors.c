@@ -0,0 +1,136 @@
+// The time left predictors compared by the accuracy benchmark (see predictors.h).
+//
+// TRICKY: The watchface source is included rather than linked, so the adapters can call its static
+// predictor functions directly (skipping the texts and layers), and is compiled with the same flags
+// as the watchface object. Its main is renamed so it does not clash with the benchmark's.
+
+#define main trekkie_main
+#include "../src/c/trekkie.c"
+#undef main
+
+#include "predictors.h"
+
+//// Watchface.
+
+// The watchface runs the USAGE_DEADLINE from its timer; here there is no event loop.
+static void run_usage_deadline(time_t current_time) {
+  if (deadlines[USAGE_DEADLINE] && deadlines[USAGE_DEADLINE] <= current_time) {
+    deadlines[USAGE_DEADLINE] = 0;
+    commit_usage(current_time);
+  }
+}
+
+static void watchface_init(BatteryChargeState battery, bool is_bluetooth_connected) {
+  init_predictors();
+  init_usage_contexts();
+  init_battery_history();
+  update_usage_bluetooth(is_bluetooth_connected);
+}
+
+// What update_battery_prediction does, without the persistence and the texts.
+static void watchface_battery(time_t current_time, BatteryChargeState battery) {
+  run_usage_deadline(current_time);
+  battery_charge_state = battery;
+  record_battery_history(current_time);
+  update_predictor(current_time);
+}
+
+static void watchface_bluetooth(time_t current_time, bool is_connected) {
+  update_usage_bluetooth(is_connected);
+}
+
+static int32_t watchface_predict(time_t current_time) {
+  run_usage_deadline(current_time);
+  int32_t exact_difference_seconds;
+  if (predict_time_left(current_time, &exact_difference_seconds) || exact_difference_seconds < 0) {
+    return -1;
+  }
+  return exact_difference_seconds >> 8;
+}
+
+//// Single models.
+
+// The remaining seconds according to a single predictor state, as predict_time_left computes them.
+static int32_t predictor_seconds(const Predictor *predictor, int target_percent, time_t current_time) {
+  if (!predictor->previous_time || !predictor->seconds_per_percent) {
+    return -1;
+  }
+  int difference_percent = abs(target_percent - predictor->previous_percent);
+  time_t time_since_previous_time = current_time - predictor->previous_time;
+  int32_t seconds = ((difference_percent * (predictor->seconds_per_percent >> 8)) >> 8)
+                  - (int32_t)time_since_previous_time;
+  return seconds < 0 ? -1 : seconds;
+}
+
+static void moving_average_battery(time_t current_time, BatteryChargeState battery) {
+  battery_charge_state = battery;
+  update_predictor(current_time);
+}
+
+// Only the moving average of the steps between readings.
+static int32_t moving_average_predict(time_t current_time) {
+  if (battery_charge_state.is_charging) {
+    return predictor_seconds(&predictors[CHARGE_PREDICTOR], 100, current_time);
+  }
+  return predictor_seconds(&predictors[DISCHARGE_PREDICTOR], 0, current_time);
+}
+
+// The line fit to the history since the last charge (falling back to the moving average), but not
+// the usage contexts.
+static int32_t regression_predict(time_t current_time) {
+  Predictor discharge_regression_predictor;
+  if (!battery_charge_state.is_charging && regression_predictor(&discharge_regression_predictor)) {
+    return predictor_seconds(&discharge_regression_predictor, 0, current_time);
+  }
+  return moving_average_predict(current_time);
+}
+
+//// Baseline.
+
+// The simplest thing that could possibly work: the average rate since the charging state changed.
+static struct {
+  BatteryChargeState battery;
+  time_t start_time;
+  int start_percent;
+  time_t previous_time;
+} segment;
+
+static void segment_init(BatteryChargeState battery, bool is_bluetooth_connected) {
+  segment.battery = battery;
+  segment.start_time = segment.previous_time = time(NULL);
+  segment.start_percent = battery.charge_percent;
+}
+
+static void segment_battery(time_t current_time, BatteryChargeState battery) {
+  if (battery.is_plugged != segment.battery.is_plugged || battery.is_charging != segment.battery.is_charging) {
+    segment.start_time = current_time;
+    segment.start_percent = battery.charge_percent;
+  }
+  if (battery.charge_percent != segment.battery.charge_percent) {
+    segment.previous_time = current_time;
+  }
+  segment.battery = battery;
+}
+
+static int32_t segment_predict(time_t current_time) {
+  int target_percent = segment.battery.is_charging ? 100 : 0;
+  int done_percent = abs(segment.battery.charge_percent - segment.start_percent);
+  if (segment.battery.is_plugged != segment.battery.is_charging || !done_percent) {
+    return -1;
+  }
+  time_t seconds_per_percent = (segment.previous_time - segment.start_time) / done_percent;
+  int32_t seconds = abs(target_percent - segment.battery.charge_percent) * seconds_per_percent
+                  - (current_time - segment.previous_time);
+  return seconds < 0 ? -1 : seconds;
+}
+
+//// Predictors.
+
+const HostPredictor host_predictors[] = {
+  { "watchface", watchface_init, watchface_battery, watchface_bluetooth, watchface_predict },
+  { "regression", watchface_init, watchface_battery, NULL, regression_predict },
+  { "moving-average", watchface_init, moving_average_battery, NULL, moving_average_predict },
+  { "segment-average", segment_init, segment_battery, NULL, segment_predict },
+};
+
+const int host_predictors_count = sizeof(host_predictors) / sizeof(host_predictors[0]);
@@ -0,0 +1,34 @@
+// Time left predictors compared by the accuracy benchmark (accuracy.c).
+//
+// The adapters are in predictors.c, which is compiled together with the watchface source, so they
+// can drive the watchface's own (static) predictor functions; the baselines do not use it at all.
+
+#ifndef PEBBLE_HOST_PREDICTORS_H
+#define PEBBLE_HOST_PREDICTORS_H
+
+#include "pebble.h"
+
+// A pluggable time left predictor.
+typedef struct {
+  // The short name shown in the report.
+  const char *name;
+
+  // Start in the given state; called once, in a fresh process, with the clock at the start.
+  void (*init)(BatteryChargeState battery, bool is_bluetooth_connected);
+
+  // A battery state event (including the initial state, right after init).
+  void (*battery)(time_t current_time, BatteryChargeState battery);
+
+  // A bluetooth connection change.
+  void (*bluetooth)(time_t current_time, bool is_connected);
+
+  // The predicted seconds until the battery is empty, or full when charging, or -1 if there is no
+  // prediction (the watchface shows some status text instead).
+  int32_t (*predict)(time_t current_time);
+} HostPredictor;
+
+// All the predictors, the watchface itself first.
+extern const HostPredictor host_predictors[];
+extern const int host_predictors_count;
+
+#endif // PEBBLE_HOST_PREDICTORS_H
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""
+Generate resource_ids.auto.h for the host build from the resources listed in package.json.
+
+The real SDK numbers the resources in the order they are listed, starting at 1. We do the same, and
+also emit the file and name of each resource so the host can load it, and the glyphs and estimated heap
+bytes of each font (as worked out by glyphs.py) so the host can verify the watchface draws nothing
+else, and account for the heap it takes.
+"""
+
+import json
+import os
+import sys
+
+
+def main(package_json, output):
+    with open(package_json) as file:
+        media = json.load(file)['pebble']['resources']['media']
+    root = os.path.dirname(os.path.abspath(package_json))
+    sys.path.insert(0, root)
+    import glyphs
+    try:
+        fonts = dict((name, (font_glyphs, heap_bytes)) for name, font_glyphs, heap_bytes in glyphs.verify_fonts(root))
+    except glyphs.GlyphError as error:
+        sys.stderr.write('resource_ids.py: %s\n' % error)
+        sys.exit(1)
+    lines = [
+        '// Generated from package.json and trekkie.c by resource_ids.py; do not edit.',
+        '',
+        '#ifndef PEBBLE_HOST_RESOURCE_IDS_AUTO_H',
+        '#define PEBBLE_HOST_RESOURCE_IDS_AUTO_H',
+        '',
+        'typedef enum {',
+        '  INVALID_RESOURCE = 0,',
+    ]
+    for index, resource in enumerate(media):
+        lines.append('  RESOURCE_ID_%s = %d,' % (resource['name'], index + 1))
+    lines += [
+        '} ResourceId;',
+        '',
+        '// The file of each resource, relative to the resources directory.',
+        '#define HOST_RESOURCE_FILES { \\',
+        '  NULL, \\',
+    ]
+    for resource in media:
+        lines.append('  "%s", \\' % resource['file'])
+    lines += [
+        '}',
+        '',
+        '// The name of each resource (for fonts, this includes the pixel size).',
+        '#define HOST_RESOURCE_NAMES { \\',
+        '  NULL, \\',
+    ]
+    for resource in media:
+        lines.append('  "%s", \\' % resource['name'])
+    lines += [
+        '}',
+        '',
+        '// The glyphs each font may draw (NULL for other resources).',
+        '#define HOST_RESOURCE_GLYPHS { \\',
+        '  NULL, \\',
+    ]
+    for resource in media:
+        if resource['name'] in fonts:
+            lines.append('  "%s", \\' % ''.join(sorted(fonts[resource['name']][0])).replace('\\', '\\\\').replace('"', '\\"'))
+        else:
+            lines.append('  NULL, \\')
+    lines += [
+        '}',
+        '',
+        '// The estimated heap bytes each font takes once loaded (0 for other resources).',
+        '#define HOST_RESOURCE_HEAP_BYTES { \\',
+        '  0, \\',
+    ]
+    for resource in media:
+        lines.append('  %d, \\' % (fonts[resource['name']][1] if resource['name'] in fonts else 0))
+    lines += [
+        '}',
+        '',
+        '#endif // PEBBLE_HOST_RESOURCE_IDS_AUTO_H',
+        '',
+    ]
+    with open(output, 'w') as file:
+        file.write('\n'.join(lines))
+
+
+if __name__ == '__main__':
+    main(*sys.argv[1:])
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""
+Decode the telemetry records the watchface logs through DataLogging into CSV.
+
+The input is the concatenated items of the telemetry session (as collected from the phone, or as
+written by `build/bench --telemetry FILE`). Each item is a little-endian `TelemetryRecord`: the
+time, the kind, a detail and a value. The names of the kinds, handlers and predictors are read from
+the enums in `trekkie.c`, so they can't get out of sync with the watchface.
+
+Usage: telemetry.py TREKKIE_C DUMP > CSV
+"""
+
+import csv
+import re
+import struct
+import sys
+import time
+
+RECORD = struct.Struct('<IBBH')
+
+# The suffix of the entries of each enum we need.
+ENUMS = {
+    'WhichTelemetry': '_TELEMETRY',
+    'WhichHandler': '_HANDLER',
+    'WhichPredictor': '_PREDICTOR',
+}
+
+
+def enum_names(source, enum, suffix):
+    """The lower case names of the entries of a C enum, without their common suffix."""
+    match = re.search(r'typedef enum \{([^}]*)\} %s;' % enum, source)
+    if not match:
+        raise SystemExit('%s: no enum in trekkie.c' % enum)
+    names = []
+    for line in match.group(1).splitlines():
+        entry = re.match(r'\s*([A-Z_]+)\s*(?:=\s*0\s*)?,', line)
+        if entry and entry.group(1).endswith(suffix):
+            names.append(entry.group(1)[:-len(suffix)].lower())
+    return names
+
+
+def describe(kind, detail, names):
+    """The kind name and the detail of a record, as shown in the CSV."""
+    kinds = names['WhichTelemetry']
+    kind_name = kinds[kind] if kind < len(kinds) else str(kind)
+    if kind_name == 'handler' and detail < len(names['WhichHandler']):
+        return kind_name, names['WhichHandler'][detail]
+    if kind_name == 'predictor' and detail < len(names['WhichPredictor']):
+        return kind_name, names['WhichPredictor'][detail]
+    if kind_name == 'battery':
+        flags = ((1, 'charging'), (2, 'plugged'))
+        return kind_name, '+'.join(flag for bit, flag in flags if detail & bit)
+    if kind_name == 'compass':
+        return kind_name, 'on' if detail else 'off'
+    return kind_name, str(detail)
+
+
+def main(trekkie_c, dump):
+    with open(trekkie_c) as file:
+        source = file.read()
+    names = dict((enum, enum_names(source, enum, suffix)) for enum, suffix in ENUMS.items())
+    with open(dump, 'rb') as file:
+        data = file.read()
+    if len(data) % RECORD.size:
+        raise SystemExit('%s: %d trailing bytes' % (dump, len(data) % RECORD.size))
+    writer = csv.writer(sys.stdout, lineterminator='\n')
+    writer.writerow(['time', 'kind', 'detail', 'value'])
+    for seconds, kind, detail, value in RECORD.iter_unpack(data):
+        kind_name, detail_text = describe(kind, detail, names)
+        when = time.strftime('%Y-%m-%d %H:%M:%S', time.gmtime(seconds))
+        writer.writerow([when, kind_name, detail_text, value])
+
+
+if __name__ == '__main__':
+    main(*sys.argv[1:])
@@ -0,0 +1,164 @@
+// Load recorded event traces (see host_load_trace in host.h).
+
+#define _GNU_SOURCE
+
+#include "host.h"
+
+#include <errno.h>
+
+void host_trace_error(const char *path, int line_number, const char *message) {
+  fprintf(stderr, "%s:%d: %s\n", path, line_number, message);
+  exit(2);
+}
+
+// Parse the words of a state line (with or without a time offset) into an event.
+// Return NULL on success or an error message.
+static const char *parse_event(char **words, int words_count, HostEvent *event) {
+  if (!strcmp(words[0], "battery")) {
+    if (words_count < 2) {
+      return "missing battery percent";
+    }
+    event->kind = EVENT_BATTERY;
+    event->battery = (BatteryChargeState){ .charge_percent = atoi(words[1]) };
+    for (int index = 2; index < words_count; ++index) {
+      if (!strcmp(words[index], "charging")) {
+        event->battery.is_charging = true;
+        event->battery.is_plugged = true;
+      } else if (!strcmp(words[index], "plugged")) {
+        event->battery.is_plugged = true;
+      } else {
+        return "unknown battery flag";
+      }
+    }
+  } else if (!strcmp(words[0], "bluetooth")) {
+    if (words_count != 2 || (strcmp(words[1], "connected") && strcmp(words[1], "disconnected"))) {
+      return "expected bluetooth connected|disconnected";
+    }
+    event->kind = EVENT_BLUETOOTH;
+    event->is_connected = !strcmp(words[1], "connected");
+  } else if (!strcmp(words[0], "compass")) {
+    if (words_count < 2) {
+      return "missing compass status";
+    }
+    event->kind = EVENT_COMPASS;
+    if (!strcmp(words[1], "calibrated")) {
+      if (words_count != 3) {
+        return "missing compass heading degrees";
+      }
+      event->compass.status = CompassStatusCalibrated;
+      event->compass.degrees = atoi(words[2]);
+    } else if (!strcmp(words[1], "calibrating")) {
+      event->compass.status = CompassStatusCalibrating;
+    } else if (!strcmp(words[1], "invalid")) {
+      event->compass.status = CompassStatusDataInvalid;
+    } else if (!strcmp(words[1], "unavailable")) {
+      event->compass.status = CompassStatusUnavailable;
+    } else {
+      return "unknown compass status";
+    }
+  } else if (!strcmp(words[0], "tap")) {
+    event->kind = EVENT_TAP;
+  } else if (!strcmp(words[0], "movement")) {
+    event->kind = EVENT_MOVEMENT;
+  } else if (!strcmp(words[0], "asleep") || !strcmp(words[0], "awake")) {
+    event->kind = EVENT_SLEEP;
+    event->is_asleep = !strcmp(words[0], "asleep");
+  } else if (!strcmp(words[0], "notification")) {
+    event->kind = EVENT_NOTIFICATION;
+  } else if (!strcmp(words[0], "peek")) {
+    if (words_count != 2 || (strcmp(words[1], "shown") && strcmp(words[1], "hidden"))) {
+      return "expected peek shown|hidden";
+    }
+    event->kind = EVENT_PEEK;
+    event->is_peek_shown = !strcmp(words[1], "shown");
+  } else if (!strcmp(words[0], "restart")) {
+    event->kind = EVENT_RESTART;
+  } else if (!strcmp(words[0], "crash")) {
+    event->kind = EVENT_CRASH;
+  } else if (!strcmp(words[0], "end")) {
+    event->kind = EVENT_END;
+  } else {
+    return "unknown event";
+  }
+  return NULL;
+}
+
+HostTrace host_load_trace(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(2);
+  }
+  HostTrace trace = { .path = path, .battery = { .charge_percent = 100 }, .is_bluetooth_connected = true,
+                  .is_24h_style = true };
+  size_t capacity = 0;
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof(line), file)) {
+    ++line_number;
+    char *comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    }
+    char *words[8];
+    int words_count = 0;
+    for (char *word = strtok(line, " \t\r\n"); word && words_count < 8; word = strtok(NULL, " \t\r\n")) {
+      words[words_count++] = word;
+    }
+    if (!words_count) {
+      continue;
+    }
+
+    if (!strcmp(words[0], "start")) {
+      struct tm start_tm = { 0 };
+      if (words_count != 3 || !strptime(words[1], "%Y-%m-%d", &start_tm)
+       || !strptime(words[2], "%H:%M:%S", &start_tm)) {
+        host_trace_error(path, line_number, "expected start YYYY-MM-DD HH:MM:SS");
+      }
+      trace.start_ms = (int64_t)mktime(&start_tm) * 1000;
+      continue;
+    }
+    if (!strcmp(words[0], "clock")) {
+      if (words_count != 2 || (strcmp(words[1], "12h") && strcmp(words[1], "24h"))) {
+        host_trace_error(path, line_number, "expected clock 12h|24h");
+      }
+      trace.is_24h_style = !strcmp(words[1], "24h");
+      continue;
+    }
+
+    HostEvent event = { 0 };
+    char *end;
+    double offset = strtod(words[0], &end);
+    bool is_event = end != words[0] && !*end;
+    const char *error = parse_event(words + is_event, words_count - is_event, &event);
+    if (error) {
+      host_trace_error(path, line_number, error);
+    }
+    if (!is_event) {
+      // An initial state line.
+      if (event.kind == EVENT_BATTERY) {
+        trace.battery = event.battery;
+      } else if (event.kind == EVENT_BLUETOOTH) {
+        trace.is_bluetooth_connected = event.is_connected;
+      } else {
+        host_trace_error(path, line_number, "expected a time offset");
+      }
+      continue;
+    }
+
+    event.time_ms = trace.start_ms + (int64_t)(offset * 1000.0 + 0.5);
+    if (trace.events_count && event.time_ms < trace.events[trace.events_count - 1].time_ms) {
+      host_trace_error(path, line_number, "events are not in time order");
+    }
+    if (trace.events_count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      trace.events = realloc(trace.events, capacity * sizeof(HostEvent));
+    }
+    trace.events[trace.events_count++] = event;
+  }
+  fclose(file);
+  if (!trace.events_count) {
+    host_trace_error(path, line_number, "no events");
+  }
+  return trace;
+}
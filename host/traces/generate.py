@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""
+Generate the synthetic event traces in this directory, and the battery traces of the predictor
+accuracy benchmark in the battery subdirectory.
+
+The traces model what the watch reports, not a real recording: the battery level in 10% steps
+(including the occasional spurious 0% reading), bluetooth disconnections with flapping at their
+edges, bursts of raw compass samples when the wrist is flicked and raised, notifications
+covering the watchface, and timeline peeks covering its bottom. They are deterministic (fixed
+random seeds) so the benchmark results are repeatable; rerun this script only when changing the
+model, and commit the results.
+"""
+
+import os
+import random
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+HOUR = 3600
+DAY = 24 * HOUR
+
+
+class Trace:
+    def __init__(self, name, description):
+        self.name = name
+        self.lines = ['# %s' % line for line in description.strip().split('\n')]
+        self.lines.append('# Generated by generate.py; do not edit.')
+        self.events = []
+
+    def state(self, line):
+        self.lines.append(line)
+
+    def event(self, time, line):
+        self.events.append((time, len(self.events), line))
+
+    def write(self, end):
+        self.event(end, 'end')
+        lines = self.lines + ['%d %s' % (time, line) for time, _, line in sorted(self.events)]
+        with open(os.path.join(HERE, self.name + '.trace'), 'w') as file:
+            file.write('\n'.join(lines) + '\n')
+
+
+def battery_line(percent, charging=False, plugged=False):
+    flags = ' charging' if charging else ' plugged' if plugged else ''
+    return 'battery %d%s' % (percent, flags)
+
+
+def reported(percent):
+    """The watch reports the level rounded up to 10% steps."""
+    return min(100, max(0, (int(percent) + 9) // 10 * 10))
+
+
+def discharge(trace, start, end, level, rate_at, rng, spurious=()):
+    """Discharge from the level at start until end (or empty); return the final level and time."""
+    levels = [(start, reported(level))]
+    time = start
+    while time < end and level > 0:
+        time += 60
+        level -= rate_at(time) / 60.0 * rng.uniform(0.8, 1.2)
+        now = reported(level)
+        if now != levels[-1][1]:
+            trace.event(time, battery_line(now))
+            levels.append((time, now))
+    for when in spurious:
+        trace.event(when, battery_line(0))
+        trace.event(when + 2, battery_line([now for time, now in levels if time < when][-1]))
+    return level, time
+
+
+def charge(trace, start, level):
+    """Charge from the level at start to full; return the time it was full."""
+    last = reported(level)
+    trace.event(start, battery_line(last, charging=True))
+    time = start
+    while level < 100:
+        time += 60
+        level += (45.0 if level < 80 else 15.0) / 60.0
+        now = reported(level)
+        if now != last:
+            last = now
+            if now < 100:
+                trace.event(time, battery_line(now, charging=True))
+    trace.event(time, battery_line(100, plugged=True))
+    return time
+
+
+def bluetooth_gaps(trace, start, end, rng, per_day):
+    """Disconnections (phone left behind) with flapping at both edges."""
+    for day in range(start // DAY, (end + DAY - 1) // DAY):
+        for _ in range(per_day):
+            gap = day * DAY + rng.randint(8 * HOUR, 22 * HOUR)
+            if gap < start or gap + 2 * HOUR > end:
+                continue
+            length = rng.randint(10 * 60, 90 * 60)
+            for edge in (gap, gap + length):
+                trace.event(edge, 'bluetooth disconnected')
+                trace.event(edge + rng.randint(2, 5), 'bluetooth connected')
+                trace.event(edge + rng.randint(6, 9), 'bluetooth disconnected')
+            trace.event(gap + length + 12, 'bluetooth connected')
+
+
+def compass_glances(trace, start, end, rng, per_day):
+    """A wrist flick, then raw compass samples at about 1Hz while the wrist is raised, during waking
+    hours."""
+    trace.event(start + 1, 'compass calibrating')
+    for day in range(start // DAY, (end + DAY - 1) // DAY):
+        for _ in range(per_day):
+            glance = day * DAY + rng.randint(7 * HOUR, 23 * HOUR)
+            if glance < start + 60 or glance + 60 > end:
+                continue
+            # Often the wrist points roughly along a sector boundary.
+            heading = rng.choice([rng.randint(0, 359), 45 * rng.randint(0, 7) + 22])
+            trace.event(glance - 1, 'tap')
+            for second in range(rng.randint(4, 9)):
+                heading = (heading + rng.randint(-15, 15)) % 360
+                trace.event(glance + second, 'compass calibrated %d' % heading)
+
+
+def notifications(trace, start, end, rng, per_day):
+    """Notifications covering the watchface for a few seconds, during waking hours."""
+    for day in range(start // DAY, (end + DAY - 1) // DAY):
+        for _ in range(per_day):
+            notification = day * DAY + rng.randint(8 * HOUR, 22 * HOUR)
+            if start < notification < end:
+                trace.event(notification, 'notification')
+
+
+def quick_views(trace, start, end, rng, per_day):
+    """Timeline peeks covering the bottom of the watchface from a few minutes before an event
+    until it starts, during waking hours (at most one an hour, so they never overlap)."""
+    for day in range(start // DAY, (end + DAY - 1) // DAY):
+        for hour in rng.sample(range(8, 22), per_day):
+            peek = day * DAY + hour * HOUR + rng.randint(0, 20 * 60)
+            length = rng.randint(5 * 60, 30 * 60)
+            if start < peek and peek + length < end:
+                trace.event(peek, 'peek shown')
+                trace.event(peek + length, 'peek hidden')
+
+
+def health(trace, start, end, rng, walks_per_day):
+    """Sleeping from about 23:00 to about 7:00, and walks during the day, each reported by the
+    Health service as a movement update every couple of minutes."""
+    for day in range(start // DAY, (end + DAY - 1) // DAY):
+        asleep = day * DAY + 23 * HOUR + rng.randint(-30 * 60, 60 * 60)
+        awake = day * DAY + DAY + 7 * HOUR + rng.randint(-60 * 60, 30 * 60)
+        if start < asleep and awake < end:
+            trace.event(asleep, 'asleep')
+            trace.event(awake, 'awake')
+        for _ in range(walks_per_day):
+            walk = day * DAY + rng.randint(8 * HOUR, 21 * HOUR)
+            length = rng.randint(5 * 60, 40 * 60)
+            if start < walk and walk + length < end:
+                for step in range(walk, walk + length, 120):
+                    trace.event(step, 'movement')
+
+
+def typical_week():
+    trace = Trace('typical-week', """
+A week of normal wear: full discharge over about six days with two spurious 0% readings, an
+overnight charge, bluetooth disconnections, compass glances, walks, notifications and timeline
+peeks during the day, sleeping at night, one restart (switching to another app and back) and one
+crash.
+""")
+    rng = random.Random(1)
+    start = 7 * HOUR
+    trace.state('start 2016-03-01 00:00:00')
+    trace.state(battery_line(100, plugged=True))
+    trace.state('bluetooth connected')
+    trace.event(start, battery_line(100))
+
+    def rate_at(time):
+        hour = time % DAY // HOUR
+        return 0.8 if 7 <= hour < 23 else 0.3
+
+    plug = 5 * DAY + 22 * HOUR
+    level, _ = discharge(trace, start, plug, 100.0, rate_at, rng,
+                      spurious=(1 * DAY + 13 * HOUR + 17, 3 * DAY + 9 * HOUR + 3))
+    full = charge(trace, plug, level)
+    unplug = 6 * DAY + 7 * HOUR
+    assert full < unplug
+    discharge(trace, unplug, 7 * DAY + start, 100.0, rate_at, rng)
+    trace.event(unplug, battery_line(100))
+
+    end = 7 * DAY + start
+    bluetooth_gaps(trace, start, end, rng, 2)
+    compass_glances(trace, start, end, rng, 25)
+    notifications(trace, start, end, rng, 6)
+    # A separate generator, so adding these did not change the other events.
+    health(trace, start, end, random.Random(101), 6)
+    quick_views(trace, start, end, random.Random(102), 3)
+    trace.event(2 * DAY + 12 * HOUR, 'restart')
+    trace.event(4 * DAY + 3 * HOUR + 30, 'crash')
+    trace.write(end)
+
+
+def idle_desk():
+    trace = Trace('idle-desk', """
+Three days on a desk: slow steady discharge, bluetooth always connected, no compass glances.
+""")
+    rng = random.Random(2)
+    start = 9 * HOUR
+    trace.state('start 2016-03-05 00:00:00')
+    trace.state(battery_line(90))
+    trace.state('bluetooth connected')
+    trace.event(start, battery_line(90))
+    end = 3 * DAY + start
+    discharge(trace, start, end, 90.0, lambda time: 0.3, rng)
+    trace.write(end)
+
+
+def day_night(day_rate, night_rate):
+    """A discharge rate (percent per hour) for waking hours and another for the night."""
+    def rate_at(time):
+        hour = time % DAY // HOUR
+        return day_rate if 7 <= hour < 23 else night_rate
+    return rate_at
+
+
+def battery_cycles(trace, start, rates, rng, spurious_per_day=0):
+    """Starting unplugged at 100%, for each of the rate functions, discharge until empty, leave the
+    watch dead for a while, charge it to full and leave it on the charger for a while. Return the
+    time of the last unplugging."""
+    time = start
+    for rate_at in rates:
+        trace.event(time, battery_line(100))
+        # Spurious readings only until the watch could possibly be empty.
+        fastest = max(rate_at(hour * HOUR) for hour in range(24))
+        spurious = [time + rng.randint(HOUR, int(90 / fastest * HOUR))
+                    for _ in range(int(spurious_per_day * 90 / fastest / 24))]
+        _, empty = discharge(trace, time, time + 30 * DAY, 100.0, rate_at, rng, spurious)
+        full = charge(trace, empty + rng.randint(HOUR, 6 * HOUR), 0.0)
+        time = full + rng.randint(HOUR, 8 * HOUR)
+    trace.event(time, battery_line(100))
+    return time
+
+
+def battery_trace(name, description, seed, rates, spurious_per_day=0, gaps_per_day=2):
+    """A trace of full battery cycles for the predictor accuracy benchmark (see accuracy.c)."""
+    trace = Trace(os.path.join('battery', name), description)
+    rng = random.Random(seed)
+    start = 7 * HOUR
+    trace.state('start 2016-04-01 00:00:00')
+    trace.state(battery_line(100, plugged=True))
+    trace.state('bluetooth connected')
+    end = battery_cycles(trace, start, rates, rng, spurious_per_day)
+    bluetooth_gaps(trace, start, end, rng, gaps_per_day)
+    trace.write(end)
+
+
+def battery_corpus():
+    battery_trace('steady-cycles', """
+Four full cycles of normal wear (0.8%/h by day, 0.3%/h at night), each run down to empty and then
+charged back to full.
+""", 11, [day_night(0.8, 0.3)] * 4)
+    battery_trace('heavy-days', """
+Four full cycles of heavy wear (2.4%/h by day, 0.6%/h at night), so each lasts about two days.
+""", 12, [day_night(2.4, 0.6)] * 4)
+    battery_trace('changing-usage', """
+Full cycles with a usage pattern that changes between them: light, heavy, heavy and light again.
+""", 13, [day_night(0.5, 0.2), day_night(1.8, 0.5), day_night(1.8, 0.5), day_night(0.5, 0.2)])
+    battery_trace('idle-to-empty', """
+Two full cycles lying on a desk (0.35%/h all the time), so each lasts almost twelve days.
+""", 14, [day_night(0.35, 0.35)] * 2, gaps_per_day=0)
+    battery_trace('spurious-readings', """
+Three full cycles of normal wear with about three spurious 0% readings a day.
+""", 15, [day_night(0.8, 0.3)] * 3, spurious_per_day=3)
+
+
+if __name__ == '__main__':
+    typical_week()
+    idle_desk()
+    battery_corpus()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+Print the .text, .data and .bss bytes an ELF file (or object) of the watchface takes, per section
+of `trekkie.c` (the `//// Section.` comments), so each group of functions can be sized against the
+memory budget. Symbols that do not come from `trekkie.c` (the SDK runtime, the C library) are
+grouped together. Read-only data counts as .text, since it lives in flash with the code.
+
+With --total, print only the total bytes of all the sections (for the host harness to check that
+the heap fits in the app memory besides them).
+
+Usage: sizes.py [--nm NM] [--total] ELF [SOURCE]
+"""
+
+import re
+import subprocess
+import sys
+
+# The group of the symbols which do not come from the watchface source.
+OTHER_GROUP = '(other)'
+
+# The output section of each nm symbol type.
+SECTIONS = {'t': '.text', 'r': '.text', 'd': '.data', 'b': '.bss', 'c': '.bss'}
+
+
+def symbol_groups(source):
+    """Map each function and static variable name in the source to the section it is defined in."""
+    groups = {}
+    group = '(top)'
+    with open(source) as file:
+        for line in file:
+            header = re.match(r'///+ (.+)\.$', line)
+            if header:
+                group = header.group(1)
+                continue
+            if line.startswith((' ', '\t')):
+                # Local statics are grouped with the function they are in.
+                definition = re.match(r'\s+static [^=;(]*?\b(\w+)(?:\[[^\]]*\])*\s*[=;]', line)
+            else:
+                definition = re.match(r'(?!typedef|#)[^=;(]*?\b(\w+)(?:\(|(?:\[[^\]]*\])*\s*[=;])', line)
+            # Skip the forward declarations, the function is defined in a later section.
+            if definition and not line.rstrip().endswith(');'):
+                groups.setdefault(definition.group(1), group)
+    return groups
+
+
+def section_sizes(elf, nm, groups):
+    """The bytes of each section per group, and the order the groups appear in."""
+    output = subprocess.check_output([nm, '--print-size', elf], universal_newlines=True)
+    sizes = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) != 4:
+            continue
+        size, kind, name = int(fields[1], 16), fields[2].lower(), fields[3]
+        if kind not in SECTIONS:
+            continue
+        # Local statics get a numeric suffix, and the compiler may add others (.constprop.0 etc.).
+        base_name = re.split(r'[.$]', name)[0]
+        group = groups.get(base_name, OTHER_GROUP)
+        group_sizes = sizes.setdefault(group, dict((section, 0) for section in set(SECTIONS.values())))
+        group_sizes[SECTIONS[kind]] += size
+    return sizes
+
+
+def main(arguments):
+    nm = 'nm'
+    if arguments[:1] == ['--nm']:
+        nm = arguments[1]
+        arguments = arguments[2:]
+    is_total_only = arguments[:1] == ['--total']
+    if is_total_only:
+        arguments = arguments[1:]
+    if not 1 <= len(arguments) <= 2:
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+    elf = arguments[0]
+    source = arguments[1] if len(arguments) > 1 else 'src/c/trekkie.c'
+    groups = symbol_groups(source)
+    sizes = section_sizes(elf, nm, groups)
+    if is_total_only:
+        print(sum(sum(group_sizes.values()) for group_sizes in sizes.values()))
+        return
+    order = []
+    for group in list(groups.values()) + [OTHER_GROUP]:
+        if group in sizes and group not in order:
+            order.append(group)
+    print('%-28s %8s %8s %8s' % ('group', '.text', '.data', '.bss'))
+    totals = dict((section, 0) for section in set(SECTIONS.values()))
+    for group in order:
+        print('%-28s %8d %8d %8d' % (group, sizes[group]['.text'], sizes[group]['.data'], sizes[group]['.bss']))
+        for section in totals:
+            totals[section] += sizes[group][section]
+    print('%-28s %8d %8d %8d' % ('total', totals['.text'], totals['.data'], totals['.bss']))
+
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
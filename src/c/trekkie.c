@@ -4,6 +4,36 @@
 // initialize the data arrays below.
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
   
+//// Platform.
+
+// TRICKY: Aplite has a black and white screen, and a quarter of the app memory of basalt (24KB for
+// the code, the static data and the heap together). So its build leaves out, at compile time, what
+// it can't show or afford: the DEBUG texts, the compass (the heading text, its events and its duty
+// cycle), the date font (the date shares the font of the other texts), and following timeline peeks
+// (aplite has none). The rest is the same code, and `make -C host APLITE=1 check` holds it to the
+// same budget as the basalt build.
+#ifdef PBL_PLATFORM_APLITE
+#undef DEBUG
+#define NO_COMPASS
+#define NO_UNOBSTRUCTED_AREA
+#endif
+
+// Aplite (like any platform the SDK doesn't define PBL_HEALTH for) has no Health service, so the
+// power governor only has the wrist flicks to go by.
+#ifndef PBL_HEALTH
+#define NO_HEALTH
+#endif
+
+// The color to draw a color stored in a table with; on black and white screens, anything which is
+// not black is white.
+static GColor table_color(uint8_t argb) {
+#ifdef PBL_COLOR
+  return (GColor){.argb = argb};
+#else
+  return argb == GColorBlackARGB8 ? GColorBlack : GColorWhite;
+#endif
+}
+
 //// Overall window.
   
 // The overall application window.
@@ -12,16 +42,560 @@ static Window *window;
 // The time we initialized everything.
 time_t init_time;
 
+static void window_appear(Window *window);
+
 static void init_window() {
   init_time = time(NULL);
   window = window_create();
-  window_stack_push(window, true /* Animated */);
+  window_set_background_color(window, GColorClear);
+  window_set_window_handlers(window, (WindowHandlers){ .appear = window_appear });
+  window_stack_push(window, false /* Animated */);
 }
 
 static void deinit_window() {
   window_destroy(window);
 }
 
+//// Telemetry.
+
+// TRICKY: To see what the watchface does over weeks of wear (how long its handlers take, how often
+// it redraws, how the battery drains), it records compact binary events into a fixed RAM ring buffer,
+// and only hands them to the DataLogging service in batches, so the phone is not contacted for each
+// one. `host/telemetry.py` decodes the logged records into CSV.
+
+// The DataLogging tag of the telemetry session.
+#define TELEMETRY_TAG 0x7E1E
+
+// How many records the ring buffer holds. When it is full (the DataLogging service was busy for a
+// while), the oldest records are dropped.
+#define TELEMETRY_RECORDS 64
+
+// How many records to collect before handing them to the DataLogging service.
+#define TELEMETRY_BATCH_RECORDS 32
+
+// The kinds of telemetry records, and the meaning of their detail and value.
+typedef enum {
+  HANDLER_TELEMETRY, // A handler ran: the WhichHandler, and how many ms it took.
+  BATTERY_TELEMETRY, // A battery sample: 1 if charging + 2 if plugged, and the percent.
+  PREDICTOR_TELEMETRY, // A predictor update: the WhichPredictor, and its seconds per percent.
+  COMPASS_TELEMETRY, // The compass was turned on or off: 1 if it is on, and 0.
+  FRAME_TELEMETRY, // A frame was drawn: how many damaged rectangles, and their area.
+  TELEMETRY_COUNT
+} WhichTelemetry;
+
+// The handlers whose time is recorded.
+typedef enum {
+  TICK_HANDLER, // The minute tick.
+  DEADLINES_HANDLER, // The scheduler timer.
+  EVENTS_HANDLER, // Committing the queued events.
+  BLUETOOTH_HANDLER, // Committing a (debounced) bluetooth connection change.
+  FLICK_HANDLER, // A wrist flick.
+  HEALTH_HANDLER, // A Health event.
+  FOCUS_HANDLER, // The app focus changing.
+  LAYOUT_HANDLER, // A frame of a timeline peek sliding in or out.
+  HANDLERS_COUNT
+} WhichHandler;
+
+// A telemetry record, as logged (little-endian, 8 bytes).
+typedef struct {
+  // When the event happened.
+  uint32_t time;
+  
+  // The WhichTelemetry kind of the record.
+  uint8_t kind;
+  
+  // A small kind-specific detail.
+  uint8_t detail;
+  
+  // The kind-specific value.
+  uint16_t value;
+} TelemetryRecord;
+
+// The ring buffer of records which were not logged yet.
+static TelemetryRecord telemetry_records[TELEMETRY_RECORDS];
+
+// The index of the oldest record in the ring buffer.
+static int first_telemetry_record;
+
+// How many records are in the ring buffer.
+static int telemetry_records_count;
+
+// How many records were dropped because the ring buffer was full.
+// Not static so it can be inspected from the outside (e.g. by the host benchmark).
+uint32_t dropped_telemetry_records;
+
+// The DataLogging session, once it was created.
+static DataLoggingSessionRef telemetry_session;
+
+// Milliseconds since some arbitrary point; only the (wrapping) difference of two of these is useful.
+static uint32_t clock_ms() {
+  time_t seconds;
+  uint16_t ms = time_ms(&seconds, NULL);
+  return (uint32_t)seconds * 1000 + ms;
+}
+
+// Hand the recorded events to the DataLogging service. If it fails, they are kept for next time.
+static void flush_telemetry() {
+  while (telemetry_session && telemetry_records_count) {
+    int records_count = TELEMETRY_RECORDS - first_telemetry_record;
+    if (records_count > telemetry_records_count) {
+      records_count = telemetry_records_count;
+    }
+    if (data_logging_log(telemetry_session, &telemetry_records[first_telemetry_record], records_count)
+        != DATA_LOGGING_SUCCESS) {
+      return;
+    }
+    first_telemetry_record = (first_telemetry_record + records_count) % TELEMETRY_RECORDS;
+    telemetry_records_count -= records_count;
+  }
+}
+
+static void record_telemetry(WhichTelemetry which_telemetry, int detail, uint32_t value) {
+  if (telemetry_records_count == TELEMETRY_RECORDS) {
+    first_telemetry_record = (first_telemetry_record + 1) % TELEMETRY_RECORDS;
+    --telemetry_records_count;
+    ++dropped_telemetry_records;
+  }
+  telemetry_records[(first_telemetry_record + telemetry_records_count++) % TELEMETRY_RECORDS]
+    = (TelemetryRecord){ time(NULL), which_telemetry, detail, value > UINT16_MAX ? UINT16_MAX : value };
+  if (telemetry_records_count >= TELEMETRY_BATCH_RECORDS) {
+    flush_telemetry();
+  }
+}
+
+// Record how long a handler took, given the clock_ms at its start.
+static void record_handler(WhichHandler which_handler, uint32_t start_ms) {
+  record_telemetry(HANDLER_TELEMETRY, which_handler, clock_ms() - start_ms);
+}
+
+static void init_telemetry() {
+  telemetry_session = data_logging_create(TELEMETRY_TAG, DATA_LOGGING_BYTE_ARRAY,
+                                          sizeof(TelemetryRecord), true /* Resume */);
+  flush_telemetry();
+}
+
+static void deinit_telemetry() {
+  if (telemetry_session) {
+    flush_telemetry();
+    data_logging_finish(telemetry_session);
+    telemetry_session = NULL;
+  }
+}
+
+//// Damage tracking.
+
+// TRICKY: The window background is clear, so the system does not erase the frame buffer between
+// frames. Instead of repainting everything whenever anything changes, we collect the screen
+// rectangles that changed, redraw just these parts of the LCARS frame, and only redraw the elements
+// overlapping them. Whenever something else may have drawn over the frame buffer (the
+// window appears or regains focus), everything is damaged.
+
+// The maximal number of separate damaged rectangles.
+// If we need more than that, we just damage the whole window.
+#define DAMAGE_RECTS_COUNT 6
+
+// A set of damaged rectangles, in window coordinates.
+typedef struct {
+  // How many rectangles are used.
+  int count;
+  
+  // The (non-overlapping) damaged rectangles.
+  GRect rects[DAMAGE_RECTS_COUNT];
+} Damage;
+
+// The damage to repaint in the next frame.
+static Damage pending_damage;
+
+// The damage being repainted in the current frame.
+static Damage frame_damage;
+
+static bool rects_overlap(GRect first, GRect second) {
+  return first.origin.x < second.origin.x + second.size.w
+      && second.origin.x < first.origin.x + first.size.w
+      && first.origin.y < second.origin.y + second.size.h
+      && second.origin.y < first.origin.y + first.size.h;
+}
+
+static GRect rects_union(GRect first, GRect second) {
+  int left = first.origin.x < second.origin.x ? first.origin.x : second.origin.x;
+  int top = first.origin.y < second.origin.y ? first.origin.y : second.origin.y;
+  int first_right = first.origin.x + first.size.w;
+  int second_right = second.origin.x + second.size.w;
+  int right = first_right > second_right ? first_right : second_right;
+  int first_bottom = first.origin.y + first.size.h;
+  int second_bottom = second.origin.y + second.size.h;
+  int bottom = first_bottom > second_bottom ? first_bottom : second_bottom;
+  return GRect(left, top, right - left, bottom - top);
+}
+
+static void damage_all() {
+  if (!pending_damage.count) {
+    layer_mark_dirty(window_get_root_layer(window));
+  }
+  pending_damage.count = 1;
+  pending_damage.rects[0] = layer_get_frame(window_get_root_layer(window));
+}
+
+// Add a (clipped, non-empty) rectangle to the damage, without scheduling a frame.
+static void add_damage(Damage *damage, GRect rect) {
+  // Merging two rectangles may cause an overlap with a third one, so start over after each merge.
+  for (int index = 0; index < damage->count; ) {
+    if (rects_overlap(rect, damage->rects[index])) {
+      rect = rects_union(rect, damage->rects[index]);
+      damage->rects[index] = damage->rects[--damage->count];
+      index = 0;
+    } else {
+      ++index;
+    }
+  }
+  if (damage->count == DAMAGE_RECTS_COUNT) {
+    damage->count = 1;
+    damage->rects[0] = layer_get_frame(window_get_root_layer(window));
+  } else {
+    damage->rects[damage->count++] = rect;
+  }
+}
+
+static void damage_rect(GRect rect) {
+  const GRect frame = layer_get_frame(window_get_root_layer(window));
+  grect_clip(&rect, &frame);
+  if (rect.size.w <= 0 || rect.size.h <= 0) {
+    return;
+  }
+  if (!pending_damage.count) {
+    layer_mark_dirty(window_get_root_layer(window));
+  }
+  add_damage(&pending_damage, rect);
+}
+
+// Called by the bottom-most layer, which is the first one to be drawn in each frame.
+static void begin_frame_damage() {
+  frame_damage = pending_damage;
+  pending_damage.count = 0;
+}
+
+static bool is_damaged(GRect rect) {
+  for (int index = 0; index < frame_damage.count; ++index) {
+    if (rects_overlap(rect, frame_damage.rects[index])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void window_appear(Window *window) {
+  damage_all();
+}
+
+static void focus_update(bool in_focus) {
+  uint32_t start_ms = clock_ms();
+  if (in_focus) {
+    damage_all();
+  }
+  record_handler(FOCUS_HANDLER, start_ms);
+}
+
+//// Frame.
+
+// TRICKY: The LCARS frame (the bars, elbows and blocks behind everything else) is drawn from a
+// table of solid rectangles, rather than from a full-window bitmap, which would take ~24KB of heap.
+// The curves of the elbows are stepped rows of rectangles rather than rounded rectangles or paths,
+// since the rounded corners of the artwork do not match any of these, while solid rectangles are
+// drawn the same on the watch and on the host. This way the frame is exactly the pixels of
+// resources/images/background.png, which is still used when building with BITMAP_FRAME, and
+// `make -C host check` verifies both builds draw the same frames.
+
+// The bottom-most layer, which draws the frame.
+static Layer *frame_layer;
+
+#ifdef BITMAP_FRAME
+
+// The whole window frame image.
+static GBitmap *frame_bitmap;
+
+static void draw_frame(GContext *ctx, GRect rect) {
+  gbitmap_set_bounds(frame_bitmap, rect);
+  graphics_draw_bitmap_in_rect(ctx, frame_bitmap, rect);
+}
+
+#else
+
+// A solid rectangle of the frame.
+typedef struct {
+  // The rectangle, in window coordinates.
+  uint8_t x;
+  uint8_t y;
+  uint8_t w;
+  uint8_t h;
+  
+  // The color of the rectangle.
+  uint8_t color;
+} FrameRect;
+
+// The rectangles of the frame, drawn in order over a black background.
+static const FrameRect frame_rects[] = {
+  // The top elbow, with the Starfleet emblem.
+  { 14, 3, 23, 32, GColorCyanARGB8 },
+  { 37, 3, 102, 4, GColorCyanARGB8 },
+  { 11, 4, 3, 31, GColorCyanARGB8 },
+  { 9, 5, 2, 30, GColorCyanARGB8 },
+  { 8, 6, 1, 29, GColorCyanARGB8 },
+  { 7, 7, 1, 28, GColorCyanARGB8 },
+  { 37, 7, 2, 4, GColorCyanARGB8 },
+  { 39, 7, 2, 2, GColorCyanARGB8 },
+  { 41, 7, 2, 1, GColorCyanARGB8 },
+  { 6, 10, 1, 25, GColorCyanARGB8 },
+  { 37, 11, 1, 2, GColorCyanARGB8 },
+  { 5, 13, 1, 22, GColorCyanARGB8 },
+  { 21, 8, 1, 22, GColorWhiteARGB8 },
+  { 20, 9, 1, 20, GColorWhiteARGB8 },
+  { 22, 9, 1, 3, GColorWhiteARGB8 },
+  { 23, 10, 1, 2, GColorWhiteARGB8 },
+  { 24, 11, 1, 2, GColorWhiteARGB8 },
+  { 25, 12, 2, 4, GColorWhiteARGB8 },
+  { 27, 13, 1, 2, GColorWhiteARGB8 },
+  { 16, 14, 2, 2, GColorWhiteARGB8 },
+  { 18, 15, 1, 3, GColorWhiteARGB8 },
+  { 24, 15, 1, 2, GColorWhiteARGB8 },
+  { 17, 16, 7, 1, GColorWhiteARGB8 },
+  { 19, 17, 1, 5, GColorWhiteARGB8 },
+  { 22, 17, 2, 1, GColorWhiteARGB8 },
+  { 18, 20, 6, 2, GColorWhiteARGB8 },
+  { 17, 21, 1, 3, GColorWhiteARGB8 },
+  { 24, 21, 1, 2, GColorWhiteARGB8 },
+  { 16, 22, 1, 2, GColorWhiteARGB8 },
+  { 18, 22, 1, 1, GColorWhiteARGB8 },
+  { 25, 22, 2, 4, GColorWhiteARGB8 },
+  { 27, 23, 1, 2, GColorWhiteARGB8 },
+  { 24, 25, 1, 2, GColorWhiteARGB8 },
+  { 22, 26, 2, 2, GColorWhiteARGB8 },
+  { 22, 28, 1, 1, GColorWhiteARGB8 },
+  // The upper blocks.
+  { 5, 36, 32, 16, GColorRichBrilliantLavenderARGB8 },
+  { 5, 53, 32, 16, GColorRichBrilliantLavenderARGB8 },
+  // The middle elbow.
+  { 5, 70, 32, 2, GColorCyanARGB8 },
+  { 6, 72, 32, 3, GColorCyanARGB8 },
+  { 38, 74, 1, 7, GColorCyanARGB8 },
+  { 7, 75, 31, 2, GColorCyanARGB8 },
+  { 39, 76, 2, 5, GColorCyanARGB8 },
+  { 8, 77, 35, 1, GColorCyanARGB8 },
+  { 9, 78, 130, 1, GColorCyanARGB8 },
+  { 10, 79, 129, 1, GColorCyanARGB8 },
+  { 14, 80, 125, 1, GColorCyanARGB8 },
+  // The lower elbow.
+  { 14, 85, 125, 3, GColorCyanARGB8 },
+  { 11, 86, 18, 11, GColorCyanARGB8 },
+  { 9, 87, 21, 8, GColorCyanARGB8 },
+  { 8, 88, 3, 9, GColorCyanARGB8 },
+  { 30, 88, 3, 2, GColorCyanARGB8 },
+  { 33, 88, 2, 1, GColorCyanARGB8 },
+  { 7, 89, 1, 8, GColorCyanARGB8 },
+  { 30, 90, 1, 2, GColorCyanARGB8 },
+  { 6, 92, 1, 5, GColorCyanARGB8 },
+  { 5, 95, 1, 2, GColorCyanARGB8 },
+  // The lower blocks.
+  { 5, 98, 24, 16, GColorRichBrilliantLavenderARGB8 },
+  { 5, 115, 24, 16, GColorRichBrilliantLavenderARGB8 },
+  // The bottom elbow, with the sun symbol.
+  { 5, 132, 24, 5, GColorCyanARGB8 },
+  { 5, 137, 3, 17, GColorCyanARGB8 },
+  { 8, 137, 2, 6, GColorCyanARGB8 },
+  { 10, 137, 1, 4, GColorCyanARGB8 },
+  { 11, 137, 1, 2, GColorCyanARGB8 },
+  { 23, 137, 7, 2, GColorCyanARGB8 },
+  { 24, 139, 7, 2, GColorCyanARGB8 },
+  { 25, 141, 8, 2, GColorCyanARGB8 },
+  { 33, 142, 2, 21, GColorCyanARGB8 },
+  { 8, 143, 1, 2, GColorCyanARGB8 },
+  { 26, 143, 110, 1, GColorCyanARGB8 },
+  { 26, 144, 7, 1, GColorCyanARGB8 },
+  { 134, 144, 3, 4, GColorCyanARGB8 },
+  { 27, 145, 6, 18, GColorCyanARGB8 },
+  { 137, 145, 1, 17, GColorCyanARGB8 },
+  { 138, 147, 1, 12, GColorCyanARGB8 },
+  { 136, 148, 1, 14, GColorCyanARGB8 },
+  { 8, 149, 1, 11, GColorCyanARGB8 },
+  { 26, 149, 1, 14, GColorCyanARGB8 },
+  { 9, 151, 1, 10, GColorCyanARGB8 },
+  { 25, 151, 1, 12, GColorCyanARGB8 },
+  { 10, 153, 1, 9, GColorCyanARGB8 },
+  { 24, 153, 1, 10, GColorCyanARGB8 },
+  { 6, 154, 2, 3, GColorCyanARGB8 },
+  { 11, 155, 1, 7, GColorCyanARGB8 },
+  { 23, 155, 1, 8, GColorCyanARGB8 },
+  { 7, 157, 16, 2, GColorCyanARGB8 },
+  { 134, 158, 2, 5, GColorCyanARGB8 },
+  { 12, 159, 11, 3, GColorCyanARGB8 },
+  { 14, 162, 120, 1, GColorCyanARGB8 },
+  { 13, 140, 1, 7, GColorYellowARGB8 },
+  { 21, 140, 1, 7, GColorYellowARGB8 },
+  { 12, 142, 3, 5, GColorYellowARGB8 },
+  { 20, 142, 3, 5, GColorYellowARGB8 },
+  { 11, 144, 5, 3, GColorYellowARGB8 },
+  { 19, 144, 5, 3, GColorYellowARGB8 },
+  { 10, 146, 15, 1, GColorYellowARGB8 },
+  { 17, 147, 1, 7, GColorYellowARGB8 },
+  { 16, 149, 3, 5, GColorYellowARGB8 },
+  { 15, 151, 5, 3, GColorYellowARGB8 },
+  { 14, 153, 7, 1, GColorYellowARGB8 },
+  { 137, 161, 1, 1, GColorMidnightGreenARGB8 },
+};
+
+#define FRAME_RECTS_COUNT (sizeof(frame_rects) / sizeof(frame_rects[0]))
+
+// The part of the rectangle to fill with black before drawing the frame rectangles over it.
+// Filling all of it would fill many pixels twice (e.g., for the texts shown over the blocks), so we
+// trim any edge of it which is wholly covered by some frame rectangle.
+static GRect background_rect(GRect rect) {
+  for (int index = 0; index < (int)FRAME_RECTS_COUNT && rect.size.w > 0 && rect.size.h > 0; ++index) {
+    const FrameRect *frame_rect = &frame_rects[index];
+    int left = frame_rect->x;
+    int top = frame_rect->y;
+    int right = left + frame_rect->w;
+    int bottom = top + frame_rect->h;
+    int rect_right = rect.origin.x + rect.size.w;
+    int rect_bottom = rect.origin.y + rect.size.h;
+    bool is_all_columns = left <= rect.origin.x && right >= rect_right;
+    bool is_all_rows = top <= rect.origin.y && bottom >= rect_bottom;
+    if (is_all_columns && top <= rect.origin.y && bottom > rect.origin.y) {
+      rect.origin.y = bottom;
+      rect.size.h = rect_bottom - bottom;
+    } else if (is_all_columns && top < rect_bottom && bottom >= rect_bottom) {
+      rect.size.h = top - rect.origin.y;
+    } else if (is_all_rows && left <= rect.origin.x && right > rect.origin.x) {
+      rect.origin.x = right;
+      rect.size.w = rect_right - right;
+    } else if (is_all_rows && left < rect_right && right >= rect_right) {
+      rect.size.w = left - rect.origin.x;
+    } else {
+      continue;
+    }
+    // Trimming one edge may expose another edge to a rectangle we already skipped, so start over.
+    index = -1;
+  }
+  return rect;
+}
+
+static void draw_frame(GContext *ctx, GRect rect) {
+  GRect black_rect = background_rect(rect);
+  if (black_rect.size.w > 0 && black_rect.size.h > 0) {
+    graphics_context_set_fill_color(ctx, GColorBlack);
+    graphics_fill_rect(ctx, black_rect, 0, GCornerNone);
+  }
+  for (size_t index = 0; index < FRAME_RECTS_COUNT; ++index) {
+    const FrameRect *frame_rect = &frame_rects[index];
+    GRect g_rect = GRect(frame_rect->x, frame_rect->y, frame_rect->w, frame_rect->h);
+    grect_clip(&g_rect, &rect);
+    if (g_rect.size.w > 0 && g_rect.size.h > 0) {
+      graphics_context_set_fill_color(ctx, table_color(frame_rect->color));
+      graphics_fill_rect(ctx, g_rect, 0, GCornerNone);
+    }
+  }
+}
+
+#endif
+
+// Restore the damaged parts of the frame buffer from the frame.
+#ifdef DEBUG
+static void track_heap_high_water();
+#endif
+
+static void first_frame_drawn();
+
+static void build_atlases(GContext *ctx);
+
+static void update_frame(Layer *layer, GContext *ctx) {
+#ifdef DEBUG
+  track_heap_high_water();
+#endif
+  first_frame_drawn();
+  begin_frame_damage();
+  build_atlases(ctx);
+  uint32_t damaged_pixels = 0;
+  for (int index = 0; index < frame_damage.count; ++index) {
+    draw_frame(ctx, frame_damage.rects[index]);
+    damaged_pixels += frame_damage.rects[index].size.w * frame_damage.rects[index].size.h;
+  }
+  record_telemetry(FRAME_TELEMETRY, frame_damage.count, damaged_pixels);
+#ifdef BITMAP_FRAME
+  gbitmap_set_bounds(frame_bitmap, layer_get_bounds(layer));
+#endif
+}
+
+static void init_frame() {
+#ifdef BITMAP_FRAME
+  frame_bitmap = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BACKGROUND);
+#endif
+  frame_layer = layer_create(layer_get_frame(window_get_root_layer(window)));
+  layer_set_update_proc(frame_layer, update_frame);
+  layer_add_child(window_get_root_layer(window), frame_layer);
+}
+
+static void deinit_frame() {
+  layer_destroy(frame_layer);
+#ifdef BITMAP_FRAME
+  gbitmap_destroy(frame_bitmap);
+#endif
+}
+
+//// Layout.
+
+// TRICKY: A timeline peek covers the bottom of the screen, hiding the battery. Rather than creating
+// other layers for it, the elements are grouped into parts, and each layout is a table row of where
+// each part goes. Following the peek as it slides in or out only moves the parts between the rows,
+// and damages just where they were and where they are now.
+
+// The parts of the screen which are placed together.
+typedef enum {
+  FIXED_PART, // Elements which stay put (the top of the screen).
+  BATTERY_PART, // The battery charge and the time left.
+  COVERED_PART, // Elements which there is no room for above a peek (the date and the work week).
+  PARTS_COUNT
+} WhichPart;
+
+// Where to place a part.
+typedef struct {
+  // How far to move the part down (or up, if negative) from its usual position.
+  int16_t dy;
+  
+  // Whether the part is shown at all.
+  bool is_shown;
+} Placement;
+
+#ifndef NO_UNOBSTRUCTED_AREA
+
+// The layouts we use.
+typedef enum {
+  FULL_LAYOUT, // Nothing covers the screen.
+  PEEK_LAYOUT, // A timeline peek covers the bottom of the screen.
+  LAYOUTS_COUNT
+} WhichLayout;
+
+// How many rows at the bottom of the screen a timeline peek covers.
+#define PEEK_HEIGHT 51
+
+// The placements of the parts in each layout. Above a peek, the battery takes the place of the date.
+static const Placement layouts[LAYOUTS_COUNT][PARTS_COUNT] = {
+  { { 0, true }, { 0, true }, { 0, true } }, // FULL_LAYOUT
+  { { 0, true }, { -48, true }, { 0, false } }, // PEEK_LAYOUT
+};
+
+#endif
+
+// The current placements of the parts.
+static Placement placements[PARTS_COUNT] = {
+  { 0, true }, // FIXED_PART
+  { 0, true }, // BATTERY_PART
+  { 0, true }, // COVERED_PART
+};
+
+// A position in a part, where it is currently placed.
+static GPoint placed_point(WhichPart which_part, GPoint point) {
+  point.y += placements[which_part].dy;
+  return point;
+}
+
 //// Images.
 
 // Used image data.
@@ -36,49 +610,70 @@ typedef struct {
   GBitmap *g_bitmap;
   
   // The layer to render the image into, obtained at init.
-  BitmapLayer *bitmap_layer;
+  Layer *layer;
 } Image;
 
 // The indices of the images we use.
 typedef enum {
-  BACKGROUND_IMAGE, // Used for the overall background.
   BLUETOOTH_IMAGE, // Used to indicate active bluetooth connection.
   IMAGES_COUNT
 } WhichImage;
 
 // The data of the images we use.
 static Image images[IMAGES_COUNT] = {
-  { RESOURCE_ID_IMAGE_BACKGROUND /* Whole window */ },
   { RESOURCE_ID_BLUETOOTH_IMAGE, { .origin = { .x = 12, .y = 6 }, { .w = 20, .h = 26 } } }
 };
 
+static void update_image(Layer *layer, GContext *ctx) {
+  const Image *image = &images[*(WhichImage *)layer_get_data(layer)];
+  if (image->g_bitmap && is_damaged(image->g_rect)) {
+    graphics_draw_bitmap_in_rect(ctx, image->g_bitmap, layer_get_bounds(layer));
+  }
+}
+
+// No image is needed for the first frame, so they all start hidden, and their bitmaps are loaded
+// after it (see init_image_bitmaps). Their layers are still created here, so they are stacked in the
+// same order.
 static void init_images() {
   for (WhichImage which_image = 0; which_image < IMAGES_COUNT; ++which_image) {
-    if (which_image == BACKGROUND_IMAGE) {
-      images[which_image].g_rect = layer_get_frame(window_get_root_layer(window));
-    }
+    images[which_image].layer = layer_create_with_data(images[which_image].g_rect, sizeof(WhichImage));
+    layer_set_hidden(images[which_image].layer, true);
+    *(WhichImage *)layer_get_data(images[which_image].layer) = which_image;
+    layer_set_update_proc(images[which_image].layer, update_image);
+    layer_add_child(window_get_root_layer(window), images[which_image].layer);
+  }
+}
+
+static void init_image_bitmaps() {
+  for (WhichImage which_image = 0; which_image < IMAGES_COUNT; ++which_image) {
     images[which_image].g_bitmap = gbitmap_create_with_resource(images[which_image].resource_id);
-    images[which_image].bitmap_layer = bitmap_layer_create(images[which_image].g_rect);
-    bitmap_layer_set_bitmap(images[which_image].bitmap_layer, images[which_image].g_bitmap);
-    layer_add_child(window_get_root_layer(window), bitmap_layer_get_layer(images[which_image].bitmap_layer));
   }
 }
 
 static void set_image_visibility(WhichImage which_image, bool is_visible) {
-  layer_set_hidden(bitmap_layer_get_layer(images[which_image].bitmap_layer), !is_visible);
+  if (layer_get_hidden(images[which_image].layer) != is_visible) {
+    return;
+  }
+  layer_set_hidden(images[which_image].layer, !is_visible);
+  damage_rect(images[which_image].g_rect);
 }
 
 static void deinit_images() {
   for (WhichImage which_image = 0; which_image < IMAGES_COUNT; ++which_image) {
-    bitmap_layer_destroy(images[which_image].bitmap_layer);
-    gbitmap_destroy(images[which_image].g_bitmap);
+    layer_destroy(images[which_image].layer);
+    if (images[which_image].g_bitmap) {
+      gbitmap_destroy(images[which_image].g_bitmap);
+    }
   }
 }
 
 //// Image updates.
 
+static void update_usage_bluetooth(bool is_connected);
+
 static void update_bluetooth_status(bool is_connected) {
   set_image_visibility(BLUETOOTH_IMAGE, is_connected);
+  update_usage_bluetooth(is_connected);
 }
 
 //// Battery graphics.
@@ -107,11 +702,14 @@ static Layer *battery_graphics_layer;
 #define BATTERY_EXTRA_HEIGHT 10
   
 static void update_battery_graphics(Layer* layer, GContext* ctx) {
+  if (!is_damaged(layer_get_frame(layer))) {
+    return;
+  }
   if (battery_charge_state.is_charging || battery_charge_state.charge_percent == 0) {
     if (battery_charge_state.is_charging) {
-      graphics_context_set_fill_color(ctx, GColorYellow);
+      graphics_context_set_fill_color(ctx, PBL_IF_COLOR_ELSE(GColorYellow, GColorWhite));
     } else {
-      graphics_context_set_fill_color(ctx, GColorRed);
+      graphics_context_set_fill_color(ctx, PBL_IF_COLOR_ELSE(GColorRed, GColorWhite));
     }
     graphics_fill_rect(ctx, GRect(0, 0,
                                   BATTERY_CHARGE_OUTER_WIDTH, BATTERY_CHARGE_OUTER_HEIGHT),
@@ -121,12 +719,13 @@ static void update_battery_graphics(Layer* layer, GContext* ctx) {
                                   BATTERY_EXTRA_WIDTH, BATTERY_EXTRA_HEIGHT),
                        0, 0);
   }
+  // Without colors, the outline and the charge are both white, which leaves the texts readable.
   if (battery_charge_state.charge_percent > 40) {
-    graphics_context_set_fill_color(ctx, GColorGreen);
+    graphics_context_set_fill_color(ctx, PBL_IF_COLOR_ELSE(GColorGreen, GColorWhite));
   } else if (battery_charge_state.charge_percent > 20) {
-    graphics_context_set_fill_color(ctx, GColorOrange);
+    graphics_context_set_fill_color(ctx, PBL_IF_COLOR_ELSE(GColorOrange, GColorWhite));
   } else {
-    graphics_context_set_fill_color(ctx, GColorRed);
+    graphics_context_set_fill_color(ctx, PBL_IF_COLOR_ELSE(GColorRed, GColorWhite));
   }
   int charge_inner_height = BATTERY_CHARGE_OUTER_HEIGHT - 2 * BATTERY_CHARGE_BORDER;
   int charge_inner_width = BATTERY_CHARGE_OUTER_WIDTH - 2 * BATTERY_CHARGE_BORDER;
@@ -137,10 +736,17 @@ static void update_battery_graphics(Layer* layer, GContext* ctx) {
                      0, 0);
 }
 
+// Where the battery charge is drawn, in the current layout.
+static GRect battery_graphics_frame() {
+  const GPoint origin = placed_point(BATTERY_PART, GPoint(BATTERY_CHARGE_LEFT, BATTERY_CHARGE_TOP));
+  return GRect(origin.x, origin.y,
+               BATTERY_CHARGE_OUTER_WIDTH + BATTERY_EXTRA_WIDTH, BATTERY_CHARGE_OUTER_HEIGHT);
+}
+
 static void init_battery_graphics() {
-  battery_graphics_layer = layer_create(GRect(BATTERY_CHARGE_LEFT, BATTERY_CHARGE_TOP,
-                                              BATTERY_CHARGE_OUTER_WIDTH + BATTERY_EXTRA_WIDTH,
-                                              BATTERY_CHARGE_OUTER_HEIGHT));
+  // The first frame shows the battery too, before init_predictors.
+  battery_charge_state = battery_state_service_peek();
+  battery_graphics_layer = layer_create(battery_graphics_frame());
   layer_add_child(window_get_root_layer(window), battery_graphics_layer);
   layer_set_update_proc(battery_graphics_layer, update_battery_graphics);
 }
@@ -151,23 +757,56 @@ static void deinit_battery_graphics() {
 
 //// Update battery graphics.
 
-static void update_time_left(time_t tick_time);
+static void update_battery_prediction(time_t current_time);
 
 static void battery_update(BatteryChargeState charge_state) {
+  if (charge_state.charge_percent != battery_charge_state.charge_percent
+   || charge_state.is_charging != battery_charge_state.is_charging) {
+    damage_rect(layer_get_frame(battery_graphics_layer));
+  }
   battery_charge_state = charge_state; // Set for battery percentage bar.
-  layer_mark_dirty(battery_graphics_layer);
-  update_time_left(time(NULL));
+  record_telemetry(BATTERY_TELEMETRY, charge_state.is_charging + 2 * charge_state.is_plugged,
+                   charge_state.charge_percent);
+  update_battery_prediction(time(NULL));
 }
 
 /// Fonts.
 
+// TRICKY: The time and the date are drawn from a dozen characters, which the font engine would look
+// up, decode and lay out again in every frame. Instead, the first frame drawn after loading such a
+// font draws each of these characters through it (white on black, at the top of the window),
+// captures their pixels from the frame buffer into a 1-bit atlas of sprites, and repaints over
+// them. From then on the texts are copied from the atlas, each character taking exactly its
+// advance. The atlas takes less heap than the font, which is unloaded once the atlas is built,
+// unless building with KEEP_SPRITE_FONTS. Build with FONT_DIGITS to draw everything through the
+// fonts instead; `make -C host check` verifies both builds draw the same frames.
+
+// The most characters a font draws from its atlas.
+#define SPRITES_COUNT 12
+
 // Used font data.
 typedef struct {
   // The automatically generated font resource index.
   int resource_id;
   
+  // The characters drawn from the atlas rather than through the font, or NULL.
+  // The texts drawn in the font may only use these characters.
+  const char *sprite_characters;
+  
   // The actual usable font object, obtained at init.
+  // NULL once the font is unloaded after building its atlas.
   GFont g_font;
+  
+  // The sprites of the characters side by side, white on black, built by build_atlases.
+  GBitmap *atlas;
+  
+  // The x of each sprite in the atlas, followed by the atlas width.
+  // Each sprite is as wide as the advance of its character, so the atlas of a large font may well
+  // be wider than 255 (LCARS 60 already takes 210).
+  uint16_t sprite_x[SPRITES_COUNT + 1];
+  
+  // The offset of the atlas (the top-most ink row of any sprite) from the top of the text.
+  uint8_t sprite_top;
 } Font;
 
 // The indices of the fonts we use.
@@ -180,14 +819,56 @@ typedef enum {
 
 // The data of the fonts we use.
 static Font fonts[FONTS_COUNT] = {
-  { RESOURCE_ID_FONT_LCARS_60 }, // TIME_FONT
-  { RESOURCE_ID_FONT_LCARS_36 }, // DATE_FONT
+  { RESOURCE_ID_FONT_LCARS_60, "0123456789:" }, // TIME_FONT
+#ifdef PBL_PLATFORM_APLITE
+  { RESOURCE_ID_FONT_LUCIDA_17 }, // DATE_FONT
+#else
+  { RESOURCE_ID_FONT_LCARS_36, "0123456789." }, // DATE_FONT
+#endif
   { RESOURCE_ID_FONT_LUCIDA_17 } // TEXT_FONT
 };
 
+// The earlier font of the same resource, if any, which owns the loaded font.
+static WhichFont font_owner(WhichFont which_font) {
+  WhichFont owner_font = 0;
+  while (fonts[owner_font].resource_id != fonts[which_font].resource_id) {
+    ++owner_font;
+  }
+  return owner_font;
+}
+
+// Whether another font shares the loaded font.
+static bool is_font_shared(WhichFont which_font) {
+  for (WhichFont other_font = 0; other_font < FONTS_COUNT; ++other_font) {
+    if (other_font != which_font && fonts[other_font].resource_id == fonts[which_font].resource_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void load_font(WhichFont which_font) {
+  // Fonts of the same resource share the loaded font, rather than each taking its own heap.
+  WhichFont owner_font = font_owner(which_font);
+  if (!fonts[owner_font].g_font) {
+    fonts[owner_font].g_font = fonts_load_custom_font(resource_get_handle(fonts[owner_font].resource_id));
+  }
+  fonts[which_font].g_font = fonts[owner_font].g_font;
+#ifdef FONT_DIGITS
+  fonts[which_font].sprite_characters = NULL;
+#endif
+}
+
+// Only the time is shown in the first frame; the other fonts are loaded after it (see init_fonts).
+static void init_time_font() {
+  load_font(TIME_FONT);
+}
+
 static void init_fonts() {
   for (WhichFont which_font = 0; which_font < FONTS_COUNT; ++which_font) {
-    fonts[which_font].g_font = fonts_load_custom_font(resource_get_handle(fonts[which_font].resource_id));
+    if (!fonts[which_font].g_font && !fonts[which_font].atlas) {
+      load_font(which_font);
+    }
   }
 }
 
@@ -195,15 +876,170 @@ static GFont font(WhichFont which_font) {
   return fonts[which_font].g_font;
 }
 
+// Whether a pixel of the captured frame buffer is white (1-bit on aplite, 8-bit elsewhere).
+static bool is_frame_buffer_white(GBitmap *frame_buffer, int x, int y) {
+  const uint8_t *row = gbitmap_get_data(frame_buffer) + y * gbitmap_get_bytes_per_row(frame_buffer);
+  if (gbitmap_get_format(frame_buffer) == GBitmapFormat1Bit) {
+    return row[x / 8] & (1 << (x % 8));
+  }
+  return row[x] == GColorWhiteARGB8;
+}
+
+// Draw the sprite characters of the font into the frame buffer, and copy them into its atlas.
+// Returns the window rectangle drawn over, which the frame must repaint.
+static GRect build_atlas(GContext *ctx, WhichFont which_font) {
+  Font *font = &fonts[which_font];
+  const GRect bounds = layer_get_bounds(frame_layer);
+  const int count = strlen(font->sprite_characters);
+  GPoint cells[SPRITES_COUNT];
+  GSize size = GSizeZero;
+  int x = 0;
+  int y = 0;
+  graphics_context_set_fill_color(ctx, GColorBlack);
+  graphics_context_set_text_color(ctx, GColorWhite);
+  for (int index = 0; index < count; ++index) {
+    char character[2] = { font->sprite_characters[index], '\0' };
+    size = graphics_text_layout_get_content_size(character, font->g_font, bounds,
+                                                 GTextOverflowModeWordWrap, GTextAlignmentLeft);
+    if (x + size.w > bounds.size.w) {
+      x = 0;
+      y += size.h;
+    }
+    cells[index] = GPoint(x, y);
+    font->sprite_x[index + 1] = font->sprite_x[index] + size.w;
+    const GRect cell = GRect(x, y, size.w, size.h);
+    graphics_fill_rect(ctx, cell, 0, GCornerNone);
+    graphics_draw_text(ctx, character, font->g_font, cell, GTextOverflowModeWordWrap,
+                       GTextAlignmentLeft, NULL);
+    x += size.w;
+  }
+  const GRect drawn = GRect(0, 0, bounds.size.w, y + size.h);
+  GBitmap *frame_buffer = graphics_capture_frame_buffer(ctx);
+  if (!frame_buffer) {
+    // Without the frame buffer to copy from, just keep drawing through the font (rather than
+    // trying again, and repainting what we drew over, in every frame).
+    font->sprite_characters = NULL;
+    return drawn;
+  }
+  // Only keep the rows which have any ink.
+  int top = size.h;
+  int bottom = 0;
+  for (int index = 0; index < count; ++index) {
+    for (int row = 0; row < size.h; ++row) {
+      for (int column = font->sprite_x[index]; column < font->sprite_x[index + 1]; ++column) {
+        if (is_frame_buffer_white(frame_buffer, cells[index].x + column - font->sprite_x[index],
+                                  cells[index].y + row)) {
+          top = row < top ? row : top;
+          bottom = row >= bottom ? row + 1 : bottom;
+        }
+      }
+    }
+  }
+  if (top < bottom) {
+    font->atlas = gbitmap_create_blank(GSize(font->sprite_x[count], bottom - top), GBitmapFormat1Bit);
+  }
+  if (font->atlas) {
+    uint8_t *data = gbitmap_get_data(font->atlas);
+    const int bytes_per_row = gbitmap_get_bytes_per_row(font->atlas);
+    for (int index = 0; index < count; ++index) {
+      for (int row = top; row < bottom; ++row) {
+        for (int column = font->sprite_x[index]; column < font->sprite_x[index + 1]; ++column) {
+          if (is_frame_buffer_white(frame_buffer, cells[index].x + column - font->sprite_x[index],
+                                    cells[index].y + row)) {
+            data[(row - top) * bytes_per_row + column / 8] |= 1 << (column % 8);
+          }
+        }
+      }
+    }
+    font->sprite_top = top;
+  } else {
+    // Without the heap for the atlas, just keep drawing through the font.
+    font->sprite_characters = NULL;
+  }
+  graphics_release_frame_buffer(ctx, frame_buffer);
+#ifndef KEEP_SPRITE_FONTS
+  if (font->atlas && !is_font_shared(which_font)) {
+    fonts_unload_custom_font(font->g_font);
+    font->g_font = NULL;
+  }
+#endif
+  return drawn;
+}
+
+// Called by the frame layer at the start of each frame, so it repaints whatever the atlases drew.
+static void build_atlases(GContext *ctx) {
+  for (WhichFont which_font = 0; which_font < FONTS_COUNT; ++which_font) {
+    const Font *font = &fonts[which_font];
+    if (font->sprite_characters && font->g_font && !font->atlas) {
+      add_damage(&frame_damage, build_atlas(ctx, which_font));
+    }
+  }
+}
+
+// The index of the sprite of a character, or -1 if the font has none for it.
+// TRICKY: glyphs.py makes sure the texts drawn from sprites only use the sprite characters, but the
+// watch does not check it, so a character it missed is skipped rather than read past the atlas.
+static int sprite_index(const Font *font, char character) {
+  const char *sprite_character = strchr(font->sprite_characters, character);
+  return sprite_character ? sprite_character - font->sprite_characters : -1;
+}
+
+// Draw a text from the atlas of its font at the top-left of the text box.
+// TRICKY: The atlas is 1-bit, and drawing it with GCompOpOr only draws its white pixels, so the
+// texts drawn from sprites are always white.
+static void draw_sprites(GContext *ctx, const Font *font, const char *text, GPoint origin) {
+  graphics_context_set_compositing_mode(ctx, GCompOpOr);
+  GRect sprite = gbitmap_get_bounds(font->atlas);
+  for (const char *character = text; *character; ++character) {
+    const int index = sprite_index(font, *character);
+    if (index < 0) {
+      continue;
+    }
+    sprite.origin.x = font->sprite_x[index];
+    sprite.size.w = font->sprite_x[index + 1] - sprite.origin.x;
+    gbitmap_set_bounds(font->atlas, sprite);
+    const GRect rect = GRect(origin.x, origin.y + font->sprite_top, sprite.size.w, sprite.size.h);
+    graphics_draw_bitmap_in_rect(ctx, font->atlas, rect);
+    origin.x += sprite.size.w;
+  }
+}
+
+// The window rectangle a text drawn from the atlas of its font covers. Unlike the text layout, this
+// is only the rows which have ink, so the seconds can be shown right under the time without the
+// time being redrawn every second.
+static GRect sprites_rect(const Font *font, const char *text, GPoint origin) {
+  int width = 0;
+  for (const char *character = text; *character; ++character) {
+    const int index = sprite_index(font, *character);
+    if (index >= 0) {
+      width += font->sprite_x[index + 1] - font->sprite_x[index];
+    }
+  }
+  return GRect(origin.x, origin.y + font->sprite_top, width, gbitmap_get_bounds(font->atlas).size.h);
+}
+
 static void deinit_fonts() {
   for (WhichFont which_font = 0; which_font < FONTS_COUNT; ++which_font) {
-    fonts_unload_custom_font(fonts[which_font].g_font);
+    if (font_owner(which_font) == which_font && fonts[which_font].g_font) {
+      fonts_unload_custom_font(fonts[which_font].g_font);
+    }
+    if (fonts[which_font].atlas) {
+      gbitmap_destroy(fonts[which_font].atlas);
+    }
   }
 }
 
 //// Texts.
 
-// Dynamic text data.
+// TRICKY: All the texts are drawn by the update proc of a single layer, using a table of the ways each
+// one can be shown (its style). Texts which are shown in different places or colors depending on the
+// state (the compass heading, the time left) are a single text which switches its style, rather than
+// several layers of which all but one are kept empty.
+
+// The maximal size of a displayed text, including the terminating NUL.
+#define TEXT_SIZE 16
+
+// A way to show a text.
 typedef struct {
   // The index of the font to use.
   WhichFont which_font;
@@ -216,21 +1052,79 @@ typedef struct {
   // We allow the text to span all the way to the end of the frame.
   GPoint origin;
   
-  // The layer to render the text into, obtained at init.
-  TextLayer *text_layer;
+  // The part of the screen the text is placed with.
+  WhichPart which_part;
+} Style;
+
+// The indices of the styles we use.
+typedef enum {
+  TIME_STYLE, // The current time.
+  SECONDS_STYLE, // The seconds of the current time, during a seconds burst.
+  DATE_STYLE, // The current date.
+  DATE_NAMES_STYLE, // The current date in text.
+#ifndef NO_COMPASS
+  ONE_LETTER_COMPASS_STYLE, // A one letter compass heading (N, S, E, W).
+  TWO_LETTER_COMPASS_STYLE, // A two letter compass heading (NE, NW, SE, SW).
+#endif
+  WORK_WEEK_STYLE, // The work week number.
+  LONG_TIME_LEFT_STYLE, // Remaining discharge time if battery is >=50, always green background.
+  SHORT_TIME_LEFT_STYLE, // Remaining discharge time if battery is <50, always black background.
+  CHARGE_TIME_LEFT_STYLE, // Remaining charge time, always light (yellow or green) background.
+#ifdef DEBUG
+  TODO_OLD_STYLE,
+  TODO_NEW_STYLE,
+#endif
+  STYLES_COUNT
+} WhichStyle;
+
+// The data of the styles we use.
+static const Style styles[STYLES_COUNT] = {
+  { TIME_FONT, GColorWhiteARGB8, { .x = 45, .y = 5 } }, // TIME_STYLE
+  { TEXT_FONT, GColorWhiteARGB8, { .x = 116, .y = 61 } }, // SECONDS_STYLE
+#ifdef PBL_PLATFORM_APLITE
+  { DATE_FONT, GColorWhiteARGB8, { .x = 38, .y = 100 }, COVERED_PART }, // DATE_STYLE
+#else
+  { DATE_FONT, GColorWhiteARGB8, { .x = 34, .y = 92 }, COVERED_PART }, // DATE_STYLE
+#endif
+  { TEXT_FONT, GColorBlackARGB8, { .x = 6, .y = 33 } }, // DATE_NAMES_STYLE
+#ifndef NO_COMPASS
+  { TEXT_FONT, GColorBlackARGB8, { .x = 12, .y = 95 } }, // ONE_LETTER_COMPASS_STYLE
+  { TEXT_FONT, GColorBlackARGB8, { .x = 7, .y = 95 } }, // TWO_LETTER_COMPASS_STYLE
+#endif
+  { TEXT_FONT, GColorBlackARGB8, { .x = 7, .y = 112 }, COVERED_PART }, // WORK_WEEK_STYLE
+  { TEXT_FONT, GColorBlackARGB8, { .x = 38, .y = 142 }, BATTERY_PART }, // LONG_TIME_LEFT_STYLE
+  { TEXT_FONT, GColorWhiteARGB8, { .x = 91, .y = 142 }, BATTERY_PART }, // SHORT_TIME_LEFT_STYLE
+  { TEXT_FONT, GColorBlackARGB8, { .x = 91, .y = 142 }, BATTERY_PART }, // CHARGE_TIME_LEFT_STYLE
+#ifdef DEBUG
+  { TEXT_FONT, GColorRedARGB8, { .x = 32, .y = 124 }, COVERED_PART }, // TODO_OLD_STYLE
+  { TEXT_FONT, GColorRedARGB8, { .x = 32, .y = 83 } }, // TODO_NEW_STYLE
+#endif
+};
+
+// Dynamic text data.
+typedef struct {
+  // The index of the style the text is shown in.
+  WhichStyle which_style;
+  
+  // A copy of the currently displayed text, which is what the layer actually renders.
+  // This allows detecting unchanged texts even when the caller rewrites its buffer in place.
+  char shown_text[TEXT_SIZE];
+  
+  // The window rectangle covered by the displayed text.
+  GRect shown_rect;
 } Text;
 
 // The indices of the text we use.
 typedef enum {
   TIME_TEXT, // The current time (HH:MM).
+  SECONDS_TEXT, // The seconds of the current time (SS), only shown during a seconds burst.
   DATE_TEXT, // The current date (stardate-ish YYYY.MM.DD).
   DATE_NAMES_TEXT, // The current date in text (3-letter month, newline, 3-letter week day).
-  COMPASS_ONE_LETTER_TEXT, // The compass heading if it is one letter (N, S, E, W).
-  COMPASS_TWO_LETTER_TEXT, // The compass heading if it is two letter (NE, NW, SE, SW).
+#ifndef NO_COMPASS
+  COMPASS_TEXT, // The compass heading.
+#endif
   WORK_WEEK_TEXT, // The work week number in the year.
-  LONG_TIME_LEFT_TEXT, // Remaining discharge time if battery is >=50, always green background.
-  SHORT_TIME_LEFT_TEXT, // Remaining discharge time if battery is <50, always black background.
-  CHARGE_TIME_LEFT_TEXT, // Remaining charge time, always light (yellow or green) background.
+  TIME_LEFT_TEXT, // Remaining (dis)charge time.
 #ifdef DEBUG
   TODO_OLD_TEXT,
   TODO_NEW_TEXT,
@@ -240,66 +1134,390 @@ typedef enum {
 
 // The data of the texts we use.
 static Text texts[TEXTS_COUNT] = {
-  { TIME_FONT, GColorWhiteARGB8, { .x = 45, .y = 5 } }, // TIME_TEXT
-  { DATE_FONT, GColorWhiteARGB8, { .x = 34, .y = 92 } }, // DATE_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 6, .y = 33 } }, // DATE_NAMES_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 12, .y = 95 } }, // COMPASS_ONE_LETTER_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 7, .y = 95 } }, // COMPASS_TWO_LETTER_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 7, .y = 112 } }, // WORK_WEEK_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 38, .y = 142 } }, // LONG_TIME_LEFT_TEXT
-  { TEXT_FONT, GColorWhiteARGB8, { .x = 91, .y = 142 } }, // SHORT_TIME_LEFT_TEXT
-  { TEXT_FONT, GColorBlackARGB8, { .x = 91, .y = 142 } }, // CHARGE_TIME_LEFT_TEXT
+  { TIME_STYLE }, // TIME_TEXT
+  { SECONDS_STYLE }, // SECONDS_TEXT
+  { DATE_STYLE }, // DATE_TEXT
+  { DATE_NAMES_STYLE }, // DATE_NAMES_TEXT
+#ifndef NO_COMPASS
+  { ONE_LETTER_COMPASS_STYLE }, // COMPASS_TEXT
+#endif
+  { WORK_WEEK_STYLE }, // WORK_WEEK_TEXT
+  { LONG_TIME_LEFT_STYLE }, // TIME_LEFT_TEXT
 #ifdef DEBUG
-  { TEXT_FONT, GColorRedARGB8, { .x = 32, .y = 124 } }, // TODO_OLD_TEXT
-  { TEXT_FONT, GColorRedARGB8, { .x = 32, .y = 83 } }, // TODO_NEW_TEXT
+  { TODO_OLD_STYLE }, // TODO_OLD_TEXT
+  { TODO_NEW_STYLE }, // TODO_NEW_TEXT
 #endif
 };
 
-static void init_texts() {
-  const GRect frame = layer_get_frame(window_get_root_layer(window));
-  for (WhichText which_text = 0; which_text < TEXTS_COUNT; ++which_text) {
-    GRect rect = frame;
-    rect.origin = texts[which_text].origin;
-    grect_clip(&rect, &frame);
-    texts[which_text].text_layer = text_layer_create(rect);
-    text_layer_set_text_color(texts[which_text].text_layer, (GColor){.argb = texts[which_text].text_color});
-    text_layer_set_background_color(texts[which_text].text_layer, GColorClear);
-    text_layer_set_font(texts[which_text].text_layer, font(texts[which_text].which_font));
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(texts[which_text].text_layer));
-  }
+// The single layer all the texts are drawn into, obtained at init.
+static Layer *texts_layer;
+
+// The top-left position of the text rectangle of the style, in the current layout.
+static GPoint style_origin(const Style *style) {
+  return placed_point(style->which_part, style->origin);
 }
 
-static void set_text(WhichText which_text, const char* data) {
-  text_layer_set_text(texts[which_text].text_layer, data);
+// The box a text in the style is laid out in.
+static GRect style_box(const Style *style) {
+  GRect box = layer_get_bounds(texts_layer);
+  box.origin = style_origin(style);
+  box.size.w -= box.origin.x;
+  box.size.h -= box.origin.y;
+  return box;
 }
 
-static void deinit_texts() {
+static void update_texts(Layer *layer, GContext *ctx) {
   for (WhichText which_text = 0; which_text < TEXTS_COUNT; ++which_text) {
-    text_layer_destroy(texts[which_text].text_layer);
+    const Text *text = &texts[which_text];
+    if (!text->shown_text[0] || !is_damaged(text->shown_rect)) {
+      continue;
+    }
+    const Style *style = &styles[text->which_style];
+    if (fonts[style->which_font].atlas) {
+      draw_sprites(ctx, &fonts[style->which_font], text->shown_text, style_origin(style));
+      continue;
+    }
+    graphics_context_set_text_color(ctx, table_color(style->text_color));
+    graphics_draw_text(ctx, text->shown_text, font(style->which_font), style_box(style),
+                       GTextOverflowModeWordWrap, GTextAlignmentLeft, NULL);
   }
 }
 
-//// Predict time left.
+static void init_texts() {
+  texts_layer = layer_create(layer_get_frame(window_get_root_layer(window)));
+  layer_set_update_proc(texts_layer, update_texts);
+  layer_add_child(window_get_root_layer(window), texts_layer);
+}
 
-// Alas, we need to maintain global state to update the predictors.
-static bool was_previous_battery_charging; // Was the battery charging last time we got an update?
+// The margin we add around the text content, for glyphs extending a bit beyond their nominal box.
+#define TEXT_DAMAGE_MARGIN 2
 
-// The keys we need for the global state.
-typedef enum {
-  PERSIST_WAS_PREVIOUS_BATTERY_CHARGING, // A boolean.
-  PERSIST_GLOBAL_FIELDS_COUNT,
-} PredictorGlobalField;
+// The window rectangle a text covers; empty if it is not shown in the current layout.
+static GRect text_content_rect(const Text *text) {
+  const Style *style = &styles[text->which_style];
+  if (!text->shown_text[0] || !placements[style->which_part].is_shown) {
+    return GRectZero;
+  }
+  const Font *text_font = &fonts[style->which_font];
+  const GPoint origin = style_origin(style);
+  if (text_font->atlas) {
+    // The sprites are exactly the ink, so they need no margin.
+    return sprites_rect(text_font, text->shown_text, origin);
+  }
+  GSize size = graphics_text_layout_get_content_size(text->shown_text, text_font->g_font,
+                                                     style_box(style),
+                                                     GTextOverflowModeWordWrap, GTextAlignmentLeft);
+  return GRect(origin.x - TEXT_DAMAGE_MARGIN, origin.y - TEXT_DAMAGE_MARGIN,
+               size.w + 2 * TEXT_DAMAGE_MARGIN, size.h + 2 * TEXT_DAMAGE_MARGIN);
+}
 
-// The state of a time left predictor.
-typedef struct {
-  // The minimal reasonable hours_per_percent.
-  double minimal_hours_per_percent;
+// How many set_text calls were suppressed because the text did not change.
+// Not static so it can be inspected from the outside (e.g. by the host benchmark).
+uint32_t suppressed_text_updates;
+
+static void set_styled_text(WhichText which_text, WhichStyle which_style, const char* data) {
+  Text *text = &texts[which_text];
+  // TRICKY: Redrawing the same text would only waste time and power.
+  if (text->which_style == which_style && !strncmp(text->shown_text, data, sizeof(text->shown_text))) {
+    ++suppressed_text_updates;
+    return;
+  }
+  damage_rect(text->shown_rect);
+  text->which_style = which_style;
+  strncpy(text->shown_text, data, sizeof(text->shown_text) - 1);
+  text->shown_rect = text_content_rect(text);
+  damage_rect(text->shown_rect);
+}
+
+static void set_text(WhichText which_text, const char* data) {
+  set_styled_text(which_text, texts[which_text].which_style, data);
+}
+
+static void deinit_texts() {
+  layer_destroy(texts_layer);
+}
+
+//// Update layout.
+
+#ifndef NO_UNOBSTRUCTED_AREA
+
+// How many rows at the bottom of the screen were obstructed at the last relayout.
+static int obstruction_height;
+
+// Move the parts to follow the unobstructed area. While a peek slides in or out, the moved parts are
+// interpolated between the layouts, so they slide along with it.
+static void relayout() {
+  const Layer *root_layer = window_get_root_layer(window);
+  const GRect bounds = layer_get_bounds(root_layer);
+  int height = bounds.size.h - layer_get_unobstructed_bounds(root_layer).size.h;
+  if (height > PEEK_HEIGHT) {
+    height = PEEK_HEIGHT;
+  }
+  // The system drew the peek over the rows it covered, so these must be drawn again once uncovered.
+  if (height < obstruction_height) {
+    damage_rect(GRect(0, bounds.size.h - obstruction_height,
+                      bounds.size.w, obstruction_height - height));
+  }
+  obstruction_height = height;
+  bool is_moved[PARTS_COUNT];
+  for (WhichPart which_part = 0; which_part < PARTS_COUNT; ++which_part) {
+    const Placement *full = &layouts[FULL_LAYOUT][which_part];
+    const Placement *peek = &layouts[PEEK_LAYOUT][which_part];
+    const Placement placement = { full->dy + (peek->dy - full->dy) * height / PEEK_HEIGHT,
+                                  height ? peek->is_shown : full->is_shown };
+    is_moved[which_part] = placement.dy != placements[which_part].dy
+                        || placement.is_shown != placements[which_part].is_shown;
+    placements[which_part] = placement;
+  }
+  for (WhichText which_text = 0; which_text < TEXTS_COUNT; ++which_text) {
+    Text *text = &texts[which_text];
+    if (is_moved[styles[text->which_style].which_part]) {
+      damage_rect(text->shown_rect);
+      text->shown_rect = text_content_rect(text);
+      damage_rect(text->shown_rect);
+    }
+  }
+  if (is_moved[BATTERY_PART]) {
+    damage_rect(layer_get_frame(battery_graphics_layer));
+    layer_set_frame(battery_graphics_layer, battery_graphics_frame());
+    damage_rect(layer_get_frame(battery_graphics_layer));
+  }
+}
+
+static void unobstructed_area_change(AnimationProgress progress, void *context) {
+  uint32_t start_ms = clock_ms();
+  relayout();
+  record_handler(LAYOUT_HANDLER, start_ms);
+}
+
+// A peek may already be showing when we start.
+static void init_layout() {
+  relayout();
+}
+
+static void subscribe_layout() {
+  UnobstructedAreaHandlers handlers = { .change = unobstructed_area_change };
+  unobstructed_area_service_subscribe(handlers, NULL);
+}
+
+static void unsubscribe_layout() {
+  unobstructed_area_service_unsubscribe();
+}
+
+#else
+
+static void init_layout() {
+}
+
+static void subscribe_layout() {
+}
+
+static void unsubscribe_layout() {
+}
+
+#endif
+
+//// Formatting.
+
+// TRICKY: strftime and snprintf pull large (and slow) general purpose formatting code into the app,
+// just to write a few digits and names. Instead we write these directly, using lookup tables.
+
+// The two decimal digits of each number from 0 to 99.
+static const char two_digits[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// The upper case abbreviated names of the week days, starting at Sunday (like tm_wday).
+static const char day_names[] = "SUNMONTUEWEDTHUFRISAT";
+
+// The upper case abbreviated names of the months, starting at January (like tm_mon).
+static const char month_names[] = "JANFEBMARAPRMAYJUNJULAUGSEPOCTNOVDEC";
+
+// Write a number from 0 to 99 as two digits, returning where the text continues.
+static char *format_two_digits(char *text, int number) {
+  text[0] = two_digits[2 * number];
+  text[1] = two_digits[2 * number + 1];
+  return text + 2;
+}
+
+// Write a number from 0 to 9 as a single digit, returning where the text continues.
+static char *format_digit(char *text, int number) {
+  text[0] = two_digits[2 * number + 1];
+  return text + 1;
+}
+
+// Write the three letters name at the index of the names, returning where the text continues.
+static char *format_name(char *text, const char *names, int index) {
+  memcpy(text, names + 3 * index, 3);
+  return text + 3;
+}
+
+// Write the time as HH:MM (needs 6 chars).
+static void format_time(char *text, const struct tm *tick_time) {
+  text = format_two_digits(text, tick_time->tm_hour);
+  *text++ = ':';
+  text = format_two_digits(text, tick_time->tm_min);
+  *text = '\0';
+}
+
+// Write the date as YYYY.MM.DD (needs 11 chars).
+static void format_date(char *text, const struct tm *tick_time) {
+  int year = 1900 + tick_time->tm_year;
+  text = format_two_digits(text, year / 100 % 100);
+  text = format_two_digits(text, year % 100);
+  *text++ = '.';
+  text = format_two_digits(text, tick_time->tm_mon + 1);
+  *text++ = '.';
+  text = format_two_digits(text, tick_time->tm_mday);
+  *text = '\0';
+}
+
+// Write the week day and month names on two lines (needs 8 chars).
+static void format_date_names(char *text, const struct tm *tick_time) {
+  text = format_name(text, day_names, tick_time->tm_wday);
+  *text++ = '\n';
+  text = format_name(text, month_names, tick_time->tm_mon);
+  *text = '\0';
+}
+
+// Write the work week number (needs 3 chars).
+// This is the week of the year starting at the first Sunday (like strftime's %U), plus the offset.
+static void format_work_week(char *text, const struct tm *tick_time, int offset) {
+  int week = (tick_time->tm_yday + 7 - tick_time->tm_wday) / 7 + offset;
+  text = format_two_digits(text, week);
+  *text = '\0';
+}
+
+// Write a time left of at least an hour as D+HH (needs 5 chars).
+// We only have room for one digit of days; that's more than the battery lasts anyway.
+static void format_days_hours(char *text, int days, int hours) {
+  if (days > 9) {
+    days = 9;
+    hours = 23;
+  }
+  text = format_digit(text, days);
+  *text++ = '+';
+  text = format_two_digits(text, hours);
+  *text = '\0';
+}
+
+// Write a time left of less than an hour as 0:MM (needs 5 chars).
+static void format_minutes(char *text, int minutes) {
+  text = format_digit(text, 0);
+  *text++ = ':';
+  text = format_two_digits(text, minutes);
+  *text = '\0';
+}
+
+//// Scheduler.
+
+// TRICKY: Most of what we show changes much less often than once a minute (the time left shows only
+// hours most of the time, the date changes once a day). So instead of recomputing everything on each
+// minute tick, each kind of deferred work records the next time it needs to run (its deadline), and
+// a single app timer is armed for the earliest of these.
+
+// The kinds of deferred work.
+typedef enum {
+  DATE_DEADLINE, // Show the new date (at midnight).
+  TIME_LEFT_DEADLINE, // Show the time left when its displayed text changes.
+  CHECKPOINT_DEADLINE, // Checkpoint what we learned when this is allowed again.
+  USAGE_DEADLINE, // Attribute the pending usage when it can no longer be spurious.
+  PROFILE_DEADLINE, // Leave the active power profile when nothing happened for a while.
+  DEADLINES_COUNT
+} WhichDeadline;
+
+// The time each kind of work needs to run at, or 0 if it need not run.
+static time_t deadlines[DEADLINES_COUNT];
+
+// The timer for the earliest deadline, if any.
+static AppTimer *deadline_timer;
+
+// The deadline the timer is armed for.
+static time_t deadline_timer_time;
+
+static void run_deadlines(void *data);
+
+static void arm_deadline_timer() {
+  time_t earliest_time = 0;
+  for (WhichDeadline which_deadline = 0; which_deadline < DEADLINES_COUNT; ++which_deadline) {
+    if (deadlines[which_deadline] && (!earliest_time || deadlines[which_deadline] < earliest_time)) {
+      earliest_time = deadlines[which_deadline];
+    }
+  }
+  if (!earliest_time) {
+    if (deadline_timer) {
+      app_timer_cancel(deadline_timer);
+      deadline_timer = NULL;
+    }
+    return;
+  }
+  if (deadline_timer && earliest_time == deadline_timer_time) {
+    return;
+  }
+  time_t current_time;
+  uint16_t current_ms = time_ms(&current_time, NULL);
+  int32_t timeout_ms = (int32_t)(earliest_time - current_time) * 1000 - current_ms;
+  if (timeout_ms < 0) {
+    timeout_ms = 0;
+  }
+  if (!deadline_timer || !app_timer_reschedule(deadline_timer, timeout_ms)) {
+    deadline_timer = app_timer_register(timeout_ms, run_deadlines, NULL);
+  }
+  deadline_timer_time = earliest_time;
+}
+
+static void schedule_deadline(WhichDeadline which_deadline, time_t deadline_time) {
+  deadlines[which_deadline] = deadline_time;
+  arm_deadline_timer();
+}
+
+static void deinit_deadlines() {
+  if (deadline_timer) {
+    app_timer_cancel(deadline_timer);
+    deadline_timer = NULL;
+  }
+}
+
+//// Predictors.
+
+// TRICKY: The watch has no floating point hardware, so double arithmetic goes through (slow and
+// large) library calls. Instead we use fixed point numbers with 16 fractional bits (Q16.16). Rates
+// are kept in seconds per percent, so the largest reasonable rate (4 hours, that is 14400 seconds per
+// percent) is well within range, and a fraction of a second is more than precise enough.
+typedef int32_t Fixed;
+
+// The fixed point representation of one.
+#define FIXED_ONE (1 << 16)
+
+// TRICKY: The rate is not the same over the whole range. The charger slows down a lot near the top
+// (the last 20% take as long as the rest), and the reported percent drops faster near empty. So
+// besides the overall rate, each predictor learns the rate in each band of PREDICTOR_BAND_PERCENT
+// percents, and the time left is the sum of the remaining bands. A step between two readings
+// (which are usually exactly a band apart) updates the bands it covers; a band we did not see yet
+// uses the overall rate.
+
+// The percents in each band.
+#define PREDICTOR_BAND_PERCENT 10
+
+// The number of bands.
+#define PREDICTOR_BANDS_COUNT (100 / PREDICTOR_BAND_PERCENT)
+
+// The state of a time left predictor.
+typedef struct {
+  // The minimal reasonable seconds_per_percent.
+  Fixed minimal_seconds_per_percent;
+  
+  // The maximal reasonable seconds_per_percent;
+  Fixed maximal_seconds_per_percent;
   
-  // The maximal reasonable hours_per_percent;
-  double maximal_hours_per_percent;
+  // How many seconds does it take to modify the state by one percent.
+  Fixed seconds_per_percent;
   
-  // How many hours does it take to modify the state by one percent.
-  double hours_per_percent;
+  // How many seconds does it take to modify the state by one percent in each band, or 0 if unknown.
+  Fixed band_seconds_per_percent[PREDICTOR_BANDS_COUNT];
   
   // The last time we saw an interesting measurement, or 0.
   time_t previous_time;
@@ -309,15 +1527,6 @@ typedef struct {
   
 } Predictor;
 
-// The indices of the predictors we use.
-// The keys we need to persist the fields of the predictor.
-typedef enum {
-  PERSIST_HOURS_TO_PERCENT, // A double.
-  PERSIST_PREVIOUS_TIME, // A 64-bit integer.
-  PERSIST_PREVIOUS_PERCENT, // An 8-bit integer.
-  PERSIST_INSTANCE_FIELDS_COUNT,
-} PredictorInstanceField;
-
 typedef enum {
   CHARGE_PREDICTOR, // Predict how long it takes to charge the battery to full.
   DISCHARGE_PREDICTOR, // Predict how long before the battery runs out.
@@ -326,8 +1535,8 @@ typedef enum {
 
 // The used predictors data.
 static Predictor predictors[PREDICTORS_COUNT] = {
-  { 0.0, 0.05 }, // CHARGE_PREDICTOR between instant and 5 hours to charge.
-  { 0.25, 4.0 }, // DISCHARGE_PREDICTOR between one day and one week to discharge.
+  { 0 * FIXED_ONE, 900 * FIXED_ONE }, // CHARGE_PREDICTOR up to 15 minutes per percent (near full).
+  { 900 * FIXED_ONE, 14400 * FIXED_ONE }, // DISCHARGE_PREDICTOR between one day and one week to discharge.
 };
 
 #ifdef DEBUG
@@ -335,37 +1544,214 @@ static int todo_old_percent;
 static time_t todo_old_time;
 #endif
 
-static time_t prediction_update_frequency;
+// When the shown time left text may change next, or 0 if it will not change on its own.
+static time_t time_left_change_time;
+
+//// Persist predictors.
+
+// TRICKY: Writing to flash is slow and wears it out, but a crash (or a firmware reset) loses
+// whatever was not written. So we keep all the predictors state in a single record, read it once at
+// init, and write it back at most every PREDICTORS_CHECKPOINT_SECONDS (and only if the learned rates
+// changed meaningfully since the last write), as well as on a clean exit. The battery history and
+// the usage contexts below are written along with them.
+
+// The minimal time between two checkpoints of the predictors.
+#define PREDICTORS_CHECKPOINT_SECONDS (30 * 60)
+
+// The learned rate must change by more than this fraction of the persisted one to be worth a checkpoint.
+#define PREDICTORS_CHECKPOINT_RATE_FRACTION 64
+
+// The version of the persisted record; increment when changing its layout.
+#define PERSIST_PREDICTORS_VERSION 2
+
+// The persisted state of a single predictor.
+typedef struct __attribute__((__packed__)) {
+  // The seconds_per_percent of the predictor.
+  Fixed seconds_per_percent;
+  
+  // The previous_time of the predictor.
+  uint32_t previous_time;
+  
+  // The previous_percent of the predictor.
+  uint8_t previous_percent;
+} PersistedPredictor;
+
+// The persisted state of all the predictors.
+typedef struct __attribute__((__packed__)) {
+  // Always PERSIST_PREDICTORS_VERSION.
+  uint8_t version;
+  
+  // The state of each predictor.
+  PersistedPredictor predictors[PREDICTORS_COUNT];
+  
+  // The band_seconds_per_percent of each predictor, in whole seconds (which fit in 16 bits).
+  // TRICKY: Version 1 had only the fields above, so its record is a prefix of this one.
+  uint16_t band_seconds_per_percent[PREDICTORS_COUNT][PREDICTOR_BANDS_COUNT];
+} PersistedPredictors;
+
+// The size of a version 1 record, which had no bands.
+#define PERSIST_PREDICTORS_VERSION_1_SIZE offsetof(PersistedPredictors, band_seconds_per_percent)
+
+// The keys used by older versions, which persisted each field separately.
+typedef enum {
+  PERSIST_WAS_PREVIOUS_BATTERY_CHARGING, // A boolean (was never actually used).
+  PERSIST_GLOBAL_FIELDS_COUNT,
+} PredictorGlobalField;
+
+typedef enum {
+  PERSIST_SECONDS_PER_PERCENT, // A 32-bit fixed point number (even older versions stored a double of hours).
+  PERSIST_PREVIOUS_TIME, // A time_t.
+  PERSIST_PREVIOUS_PERCENT, // An 8-bit integer.
+  PERSIST_INSTANCE_FIELDS_COUNT,
+} PredictorInstanceField;
+
+// The key of the persisted record, following the keys used by older versions.
+#define PERSIST_PREDICTORS_KEY (PERSIST_GLOBAL_FIELDS_COUNT + PREDICTORS_COUNT * PERSIST_INSTANCE_FIELDS_COUNT)
+
+// The last record we read or wrote.
+static PersistedPredictors persisted_predictors;
+
+// The last time we wrote a checkpoint (or read the record at init).
+static time_t checkpoint_time;
 
 static int predictor_instance_field_key(WhichPredictor which_predictor, PredictorInstanceField predictor_instance_field) {
   return PERSIST_GLOBAL_FIELDS_COUNT + which_predictor * PERSIST_INSTANCE_FIELDS_COUNT + predictor_instance_field;
 }
 
-static void init_predictors() {
-  battery_charge_state = battery_state_service_peek();
-  was_previous_battery_charging = battery_charge_state.is_charging;
-  if (persist_exists(PERSIST_WAS_PREVIOUS_BATTERY_CHARGING)) {
-    was_previous_battery_charging = persist_read_bool(PERSIST_WAS_PREVIOUS_BATTERY_CHARGING);
+// Convert the (raw bits of the) double hours per percent persisted by older versions.
+// TRICKY: We decode the IEEE-754 bits by hand, to avoid pulling in the floating point library just
+// for this one-time migration. Anything negative, tiny or huge is converted to zero (unknown).
+static Fixed seconds_per_percent_from_legacy_hours(uint64_t bits) {
+  int exponent = (int)((bits >> 52) & 0x7FF);
+  if ((bits >> 63) || !exponent) {
+    return 0;
+  }
+  // The value is (2^52 + mantissa) * 2^(exponent - 1075) hours, and we want it times 3600 * 2^16.
+  // Dropping the low 12 bits of the mantissa leaves room for multiplying by 3600 < 2^12.
+  uint64_t scaled = (((bits & 0xFFFFFFFFFFFFF) | ((uint64_t)1 << 52)) >> 12) * 3600;
+  int shift = 1047 - exponent;
+  if (shift <= 0 || shift >= 64) {
+    return 0;
   }
+  scaled >>= shift;
+  return scaled < INT32_MAX ? (Fixed)scaled : 0;
+}
+
+// Load the predictors from the keys used by older versions, and delete them.
+static void migrate_legacy_predictors() {
   for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
-    int field_key = predictor_instance_field_key(which_predictor, PERSIST_HOURS_TO_PERCENT);
-    if (persist_exists(field_key)) {
-      persist_read_data(field_key, &predictors[which_predictor].hours_per_percent,
-                        sizeof(predictors[which_predictor].hours_per_percent));
+    int field_key = predictor_instance_field_key(which_predictor, PERSIST_SECONDS_PER_PERCENT);
+    switch (persist_get_size(field_key)) {
+      case sizeof(Fixed):
+        persist_read_data(field_key, &predictors[which_predictor].seconds_per_percent,
+                          sizeof(predictors[which_predictor].seconds_per_percent));
+        break;
+      case sizeof(uint64_t):
+        {
+          uint64_t legacy_hours_per_percent;
+          persist_read_data(field_key, &legacy_hours_per_percent, sizeof(legacy_hours_per_percent));
+          predictors[which_predictor].seconds_per_percent =
+            seconds_per_percent_from_legacy_hours(legacy_hours_per_percent);
+        }
+        break;
     }
+    persist_delete(field_key);
     field_key = predictor_instance_field_key(which_predictor, PERSIST_PREVIOUS_TIME);
     if (persist_exists(field_key)) {
       persist_read_data(field_key, &predictors[which_predictor].previous_time,
                         sizeof(predictors[which_predictor].previous_time));
+      persist_delete(field_key);
     }
-    predictors[which_predictor].previous_percent = battery_charge_state.charge_percent;
-    if (predictors[which_predictor].previous_time) {
-      field_key = predictor_instance_field_key(which_predictor, PERSIST_PREVIOUS_PERCENT);
-      if (persist_exists(field_key)) {
+    field_key = predictor_instance_field_key(which_predictor, PERSIST_PREVIOUS_PERCENT);
+    if (persist_exists(field_key)) {
+      if (predictors[which_predictor].previous_time) {
         predictors[which_predictor].previous_percent = persist_read_int(field_key);
       }
+      persist_delete(field_key);
+    }
+  }
+  persist_delete(PERSIST_WAS_PREVIOUS_BATTERY_CHARGING);
+}
+
+static void pack_predictors(PersistedPredictors *record) {
+  record->version = PERSIST_PREDICTORS_VERSION;
+  for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
+    record->predictors[which_predictor].seconds_per_percent = predictors[which_predictor].seconds_per_percent;
+    record->predictors[which_predictor].previous_time = predictors[which_predictor].previous_time;
+    record->predictors[which_predictor].previous_percent = predictors[which_predictor].previous_percent;
+    for (int which_band = 0; which_band < PREDICTOR_BANDS_COUNT; ++which_band) {
+      Fixed band_seconds_per_percent = predictors[which_predictor].band_seconds_per_percent[which_band];
+      record->band_seconds_per_percent[which_predictor][which_band] =
+        (band_seconds_per_percent + FIXED_ONE / 2) / FIXED_ONE;
     }
   }
+}
+
+static void unpack_predictors(const PersistedPredictors *record) {
+  for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
+    for (int which_band = 0; which_band < PREDICTOR_BANDS_COUNT; ++which_band) {
+      predictors[which_predictor].band_seconds_per_percent[which_band] =
+        record->band_seconds_per_percent[which_predictor][which_band] * FIXED_ONE;
+    }
+    predictors[which_predictor].seconds_per_percent = record->predictors[which_predictor].seconds_per_percent;
+    predictors[which_predictor].previous_time = record->predictors[which_predictor].previous_time;
+    if (predictors[which_predictor].previous_time) {
+      predictors[which_predictor].previous_percent = record->predictors[which_predictor].previous_percent;
+    }
+  }
+}
+
+static void write_predictors(time_t current_time) {
+  pack_predictors(&persisted_predictors);
+  persist_write_data(PERSIST_PREDICTORS_KEY, &persisted_predictors, sizeof(persisted_predictors));
+  checkpoint_time = current_time;
+}
+
+// Whether the predictors learned something worth a checkpoint since the last write.
+static bool is_worth_checkpoint() {
+  for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
+    const Predictor *predictor = &predictors[which_predictor];
+    const PersistedPredictor *persisted = &persisted_predictors.predictors[which_predictor];
+    if (predictor->previous_time && !persisted->previous_time) {
+      return true;
+    }
+    Fixed change = predictor->seconds_per_percent - persisted->seconds_per_percent;
+    if (change < 0) {
+      change = -change;
+    }
+    if (change > persisted->seconds_per_percent / PREDICTORS_CHECKPOINT_RATE_FRACTION) {
+      return true;
+    }
+    for (int which_band = 0; which_band < PREDICTOR_BANDS_COUNT; ++which_band) {
+      int persisted_seconds = persisted_predictors.band_seconds_per_percent[which_predictor][which_band];
+      int band_change = predictor->band_seconds_per_percent[which_band] / FIXED_ONE - persisted_seconds;
+      if (abs(band_change) > persisted_seconds / PREDICTORS_CHECKPOINT_RATE_FRACTION) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void init_predictors() {
+  battery_charge_state = battery_state_service_peek();
+  for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
+    predictors[which_predictor].previous_percent = battery_charge_state.charge_percent;
+  }
+  checkpoint_time = time(NULL);
+  PersistedPredictors record = { 0 };
+  int size = persist_read_data(PERSIST_PREDICTORS_KEY, &record, sizeof(record));
+  if (size == sizeof(record) && record.version == PERSIST_PREDICTORS_VERSION) {
+    unpack_predictors(&record);
+    persisted_predictors = record;
+  } else if (size == PERSIST_PREDICTORS_VERSION_1_SIZE && record.version == 1) {
+    // The bands are left unknown, until they are learned.
+    unpack_predictors(&record);
+    write_predictors(checkpoint_time);
+  } else if (persist_exists(PERSIST_WAS_PREVIOUS_BATTERY_CHARGING)) {
+    migrate_legacy_predictors();
+    write_predictors(checkpoint_time);
+  }
 #ifdef DEBUG
   todo_old_percent = predictors[DISCHARGE_PREDICTOR].previous_percent;
   todo_old_time = predictors[DISCHARGE_PREDICTOR].previous_time;
@@ -373,56 +1759,818 @@ static void init_predictors() {
 }
 
 static void deinit_predictors() {
-  persist_write_bool(PERSIST_WAS_PREVIOUS_BATTERY_CHARGING, was_previous_battery_charging);
-  for (WhichPredictor which_predictor = 0; which_predictor < PREDICTORS_COUNT; ++which_predictor) {
-    int field_key = predictor_instance_field_key(which_predictor, PERSIST_HOURS_TO_PERCENT);
-    persist_write_data(field_key, &predictors[which_predictor].hours_per_percent,
-                       sizeof(predictors[which_predictor].hours_per_percent));
-    field_key = predictor_instance_field_key(which_predictor, PERSIST_PREVIOUS_TIME);
-    persist_write_data(field_key, &predictors[which_predictor].previous_time,
-                       sizeof(predictors[which_predictor].previous_time));
-    field_key = predictor_instance_field_key(which_predictor, PERSIST_PREVIOUS_PERCENT);
-    persist_write_int(field_key, predictors[which_predictor].previous_percent);
+  PersistedPredictors record;
+  pack_predictors(&record);
+  if (memcmp(&record, &persisted_predictors, sizeof(record))) {
+    write_predictors(time(NULL));
+  }
+}
+
+//// Battery history.
+
+// TRICKY: The moving average of the predictors above only knows about the previous measurement, so a
+// single odd reading skews it for hours, and it takes days to adapt after a change in usage. So we
+// also keep a history of the (time, percent) discharge samples, that survives restarts. Each sample
+// is stored as the difference from the previous one, in whole minutes and percents, so the whole
+// history fits in a single persisted record. The absolute time and percent are kept only for the
+// newest sample; older samples are reconstructed by walking backwards.
+
+// The number of samples in the history.
+#define HISTORY_SAMPLES_COUNT 64
+
+// The version of the persisted history; increment when changing its layout.
+#define PERSIST_HISTORY_VERSION 1
+
+// The key of the persisted history, following the persisted predictors.
+#define PERSIST_HISTORY_KEY (PERSIST_PREDICTORS_KEY + 1)
+
+// The maximal minutes we can store in a sample; longer gaps always start a new segment.
+#define HISTORY_MAX_MINUTES 0x7FFF
+
+// A reading that goes back up this soon after a drop means the drop was spurious.
+#define HISTORY_SPURIOUS_SECONDS (5 * 60)
+
+// A single discharge sample.
+typedef struct __attribute__((__packed__)) {
+  // The minutes since the previous sample.
+  uint16_t minutes : 15;
+  
+  // Whether this sample starts a new discharge segment (after unplugging the charger, or after a gap).
+  uint16_t is_segment_start : 1;
+  
+  // The percent change since the previous sample.
+  int8_t percent_delta;
+} HistorySample;
+
+// The persisted history.
+typedef struct __attribute__((__packed__)) {
+  // Always PERSIST_HISTORY_VERSION.
+  uint8_t version;
+  
+  // How many samples are used.
+  uint8_t count;
+  
+  // The index of the newest sample.
+  uint8_t newest;
+  
+  // The time of the newest sample.
+  uint32_t newest_time;
+  
+  // The percent of the newest sample.
+  uint8_t newest_percent;
+  
+  // The samples, a ring buffer.
+  HistorySample samples[HISTORY_SAMPLES_COUNT];
+} History;
+
+static History history = { PERSIST_HISTORY_VERSION };
+
+// Whether the charger was plugged at the last battery update.
+static bool was_plugged;
+
+static int previous_history_index(int index) {
+  return (index + HISTORY_SAMPLES_COUNT - 1) % HISTORY_SAMPLES_COUNT;
+}
+
+static int next_history_index(int index) {
+  return (index + 1) % HISTORY_SAMPLES_COUNT;
+}
+
+//// Regression predictor.
+
+// TRICKY: We fit the time as a linear function of the percent, over the samples of the current
+// discharge segment (up to REGRESSION_WINDOW_SAMPLES of them). The slope of the least squares fit is
+// the seconds per percent. The percents are exact (they are the moments the reported value changed)
+// while the times are noisy, hence the choice of variables. We keep running sums so adding a sample
+// (and dropping the oldest one when the window is full) is O(1). The sums are 64 bit since the
+// products of times and percents over the window may exceed 32 bits.
+
+// The maximal number of samples to fit.
+#define REGRESSION_WINDOW_SAMPLES 16
+
+// The state of the regression predictor.
+typedef struct {
+  // How many samples are in the window.
+  int count;
+  
+  // The history index of the oldest sample in the window.
+  int oldest_index;
+  
+  // The time of the oldest sample in the window.
+  time_t oldest_time;
+  
+  // The percent of the oldest sample in the window.
+  int oldest_percent;
+  
+  // The times in the sums are relative to this, to keep them small.
+  time_t origin_time;
+  
+  // The sums of the (relative) times, percents, squared percents and times multiplied by percents.
+  int64_t sum_time;
+  int64_t sum_percent;
+  int64_t sum_percent_squared;
+  int64_t sum_time_percent;
+} Regression;
+
+static Regression regression;
+
+static void regression_add(time_t time, int percent, int sign) {
+  int64_t relative_time = time - regression.origin_time;
+  regression.count += sign;
+  regression.sum_time += sign * relative_time;
+  regression.sum_percent += sign * percent;
+  regression.sum_percent_squared += sign * percent * percent;
+  regression.sum_time_percent += sign * relative_time * percent;
+}
+
+static void regression_start(int index, time_t time, int percent) {
+  regression = (Regression){ .oldest_index = index, .oldest_time = time, .oldest_percent = percent,
+                             .origin_time = time };
+  regression_add(time, percent, +1);
+}
+
+// Add the (already recorded) newest history sample.
+static void regression_push(int index, time_t time, int percent) {
+  if (regression.count == REGRESSION_WINDOW_SAMPLES) {
+    regression_add(regression.oldest_time, regression.oldest_percent, -1);
+    regression.oldest_index = next_history_index(regression.oldest_index);
+    const HistorySample *sample = &history.samples[regression.oldest_index];
+    regression.oldest_time += sample->minutes * 60;
+    regression.oldest_percent += sample->percent_delta;
+  }
+  regression_add(time, percent, +1);
+}
+
+// Rebuild the regression from the history, walking backwards from the newest sample.
+static void regression_restore() {
+  regression = (Regression){ 0 };
+  int index = history.newest;
+  time_t time = history.newest_time;
+  int percent = history.newest_percent;
+  for (int which_sample = 0; which_sample < history.count && which_sample < REGRESSION_WINDOW_SAMPLES; ++which_sample) {
+    regression_add(time, percent, +1);
+    regression.oldest_index = index;
+    regression.oldest_time = time;
+    regression.oldest_percent = percent;
+    const HistorySample *sample = &history.samples[index];
+    if (sample->is_segment_start) {
+      break;
+    }
+    time -= sample->minutes * 60;
+    percent -= sample->percent_delta;
+    index = previous_history_index(index);
+  }
+  // TRICKY: The sums were computed relative to the zero origin, so shift them to the segment start.
+  // This is exact: with t' = t - d, sum(t') = sum(t) - n * d and sum(t' * p) = sum(t * p) - d * sum(p).
+  time_t origin_time = regression.oldest_time;
+  regression.sum_time -= regression.count * (int64_t)origin_time;
+  regression.sum_time_percent -= origin_time * regression.sum_percent;
+  regression.origin_time = origin_time;
+}
+
+// Fill a predictor with the regression results, if there are enough samples for a reasonable fit.
+static bool regression_predictor(Predictor *predictor) {
+  if (!history.count || regression.count < 2) {
+    return false;
+  }
+  int64_t denominator = regression.count * regression.sum_percent_squared
+                      - regression.sum_percent * regression.sum_percent;
+  if (denominator <= 0) {
+    return false;
+  }
+  int64_t numerator = regression.count * regression.sum_time_percent - regression.sum_time * regression.sum_percent;
+  // The slope is negative (time goes up as percent goes down).
+  int64_t seconds_per_percent = -numerator * FIXED_ONE / denominator;
+  *predictor = predictors[DISCHARGE_PREDICTOR];
+  if (seconds_per_percent <= predictor->minimal_seconds_per_percent
+   || seconds_per_percent >= predictor->maximal_seconds_per_percent) {
+    return false;
+  }
+  predictor->seconds_per_percent = (Fixed)seconds_per_percent;
+  // The fit already follows the recent rate, so it does not use the bands.
+  memset(predictor->band_seconds_per_percent, 0, sizeof(predictor->band_seconds_per_percent));
+  predictor->previous_time = history.newest_time;
+  predictor->previous_percent = history.newest_percent;
+  return true;
+}
+
+//// Usage contexts.
+
+// TRICKY: The discharge rate depends on what the watch is doing: whether bluetooth is connected,
+// whether the compass is on, and whether it is day or night (when the watch mostly sits idle). So we
+// also learn a rate for each combination of these (a context). We track how long each context was
+// active between two history samples, and split the percent drop between them in proportion to
+// their time multiplied by the rate we already believe each of them has. The time left is then
+// predicted by walking forward hour by hour, assuming the current bluetooth state, the observed
+// compass duty cycle, and the night hours.
+//
+// TRICKY: The projection is only as good as the contexts are at explaining the usage, and when the
+// usage changes they lag far behind the line fit (on the changing-usage battery trace, using them
+// unconditionally made the mean error 36h instead of the fit's 14h). So each discharge step also
+// scores what both of them forecast for it at the previous step, and the projection is only used
+// while its recent error is smaller than the fit's.
+
+// The flags making up a context (which is an index into the models).
+typedef enum {
+  CONTEXT_BLUETOOTH = 1 << 0, // Bluetooth is connected.
+  CONTEXT_COMPASS = 1 << 1, // The compass is on.
+  CONTEXT_NIGHT = 1 << 2, // It is night.
+  CONTEXTS_COUNT = 1 << 3
+} ContextFlag;
+
+// The night hours, when the watch is mostly idle.
+#define NIGHT_START_HOUR 23
+#define NIGHT_END_HOUR 7
+
+// Once a context accumulates this much time, we halve its time and percent, to forget old behavior.
+#define CONTEXT_MEMORY_SECONDS (3 * 24 * 3600)
+
+// A context needs this much time before we trust its rate for predictions.
+#define CONTEXT_MINIMAL_SECONDS (3 * 3600)
+
+// We don't walk forward more than this many hours (which is more than anything we can display).
+#define CONTEXT_MAXIMAL_HOURS (10 * 24)
+
+// How many discharge steps both forecasts must be scored on before we trust the comparison.
+#define FORECAST_MINIMAL_SCORES 3
+
+// The relative error of a single forecast is clamped to this (a Fixed fraction).
+#define FORECAST_MAXIMAL_ERROR (4 * FIXED_ONE)
+
+// The version of the persisted contexts; increment when changing their layout.
+#define PERSIST_CONTEXTS_VERSION 2
+
+// The key of the persisted contexts, following the persisted history.
+#define PERSIST_CONTEXTS_KEY (PERSIST_HISTORY_KEY + 1)
+
+// What we learned about a single context.
+typedef struct __attribute__((__packed__)) {
+  // The percents attributed to the context.
+  Fixed percent;
+  
+  // The seconds the context was active.
+  uint32_t seconds;
+} ContextModel;
+
+// The persisted contexts.
+typedef struct __attribute__((__packed__)) {
+  // Always PERSIST_CONTEXTS_VERSION.
+  uint8_t version;
+  
+  // The model of each context.
+  ContextModel models[CONTEXTS_COUNT];
+  
+  // The moving averages of the relative errors (Fixed fractions) of the forecasts of the line fit
+  // and of the context projection, over the recent discharge steps.
+  Fixed fit_error;
+  Fixed context_error;
+  
+  // How many discharge steps the above were scored on, up to FORECAST_MINIMAL_SCORES.
+  uint8_t scores;
+} Contexts;
+
+// The size of version 1 of the persisted contexts, which had only the models.
+#define PERSIST_CONTEXTS_VERSION_1_SIZE offsetof(Contexts, fit_error)
+
+static Contexts contexts = { PERSIST_CONTEXTS_VERSION };
+
+// Whether the contexts changed since we last wrote them.
+static bool is_contexts_dirty;
+
+// The current context flags, other than CONTEXT_NIGHT (which depends on the time).
+static int usage_flags;
+
+// The time we accounted for the active contexts up to.
+static time_t usage_time;
+
+// The seconds each context was active since the newest history sample.
+static int32_t usage_seconds[CONTEXTS_COUNT];
+
+// What we forecast at a history sample for the step until the next one.
+typedef struct {
+  // The seconds per percent of the line fit, or 0 if it had none.
+  Fixed seconds_per_percent;
+  
+  // The context flags in effect (other than CONTEXT_NIGHT), which the context projection assumes.
+  int flags;
+} Forecast;
+
+// The newest history sample, whose percents we did not attribute yet since it may be spurious.
+typedef struct {
+  // Whether there is such a sample.
+  bool is_pending;
+  
+  // The time of the sample.
+  time_t time;
+  
+  // The percent drop since the previous sample.
+  int percent_drop;
+  
+  // The seconds each context was active since the previous sample.
+  int32_t seconds[CONTEXTS_COUNT];
+  
+  // What we forecast at the previous sample.
+  Forecast forecast;
+} PendingUsage;
+
+static PendingUsage pending_usage;
+
+// What we forecast at the newest sample.
+static Forecast forecast;
+
+static bool is_night_hour(int hour) {
+  return hour >= NIGHT_START_HOUR || hour < NIGHT_END_HOUR;
+}
+
+// Add the time since we last did so to the active contexts, splitting it at hour boundaries.
+static void account_usage(time_t current_time) {
+  while (usage_time < current_time) {
+    struct tm *usage_tm = localtime(&usage_time);
+    time_t hour_end = usage_time + 3600 - usage_tm->tm_min * 60 - usage_tm->tm_sec;
+    time_t end_time = hour_end < current_time ? hour_end : current_time;
+    int context = usage_flags | (is_night_hour(usage_tm->tm_hour) ? CONTEXT_NIGHT : 0);
+    usage_seconds[context] += end_time - usage_time;
+    usage_time = end_time;
+  }
+  usage_time = current_time;
+}
+
+static void update_usage_flag(ContextFlag flag, bool is_set) {
+  account_usage(time(NULL));
+  usage_flags = is_set ? usage_flags | flag : usage_flags & ~flag;
+}
+
+static void update_usage_bluetooth(bool is_connected) {
+  update_usage_flag(CONTEXT_BLUETOOTH, is_connected);
+}
+
+// The learned rate of a context in percents per hour, or 0 if we know nothing about it.
+static Fixed context_rate(int context) {
+  const ContextModel *model = &contexts.models[context];
+  return model->seconds ? (Fixed)((int64_t)model->percent * 3600 / model->seconds) : 0;
+}
+
+// The learned rate over all the contexts in percents per hour, or 0 if we know nothing.
+static Fixed overall_rate() {
+  int64_t percent = 0;
+  int64_t seconds = 0;
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    percent += contexts.models[context].percent;
+    seconds += contexts.models[context].seconds;
   }
+  return seconds ? (Fixed)(percent * 3600 / seconds) : 0;
+}
+
+static bool context_predict(int flags, time_t start_time, int percent, int32_t *seconds);
+
+// The rate the line fit (or, until there is one, the moving average) forecasts for the next step.
+static Fixed fit_seconds_per_percent() {
+  Predictor discharge_regression_predictor;
+  if (regression_predictor(&discharge_regression_predictor)) {
+    return discharge_regression_predictor.seconds_per_percent;
+  }
+  return predictors[DISCHARGE_PREDICTOR].seconds_per_percent;
+}
+
+// Return the moving average of the relative error updated with the given forecast.
+static Fixed updated_forecast_error(Fixed error, int32_t forecast_seconds, int32_t actual_seconds) {
+  int64_t step_error = (int64_t)abs(forecast_seconds - actual_seconds) * FIXED_ONE / actual_seconds;
+  if (step_error > FORECAST_MAXIMAL_ERROR) {
+    step_error = FORECAST_MAXIMAL_ERROR;
+  }
+  // Each step weighs an eighth, so one lucky step can't flip which forecast we trust.
+  return contexts.scores ? error + ((Fixed)step_error - error) / 8 : (Fixed)step_error;
+}
+
+// Score the forecasts made at the previous sample against the actual step, before the contexts
+// learn from it.
+static void score_forecasts(const PendingUsage *pending) {
+  int32_t actual_seconds = 0;
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    actual_seconds += pending->seconds[context];
+  }
+  int32_t context_seconds;
+  if (!pending->forecast.seconds_per_percent || actual_seconds <= 0 || pending->percent_drop <= 0
+   || !context_predict(pending->forecast.flags, pending->time - actual_seconds, pending->percent_drop,
+                       &context_seconds)) {
+    return;
+  }
+  int32_t fit_seconds = (int64_t)pending->forecast.seconds_per_percent * pending->percent_drop / FIXED_ONE;
+  contexts.fit_error = updated_forecast_error(contexts.fit_error, fit_seconds, actual_seconds);
+  contexts.context_error = updated_forecast_error(contexts.context_error, context_seconds, actual_seconds);
+  if (contexts.scores < FORECAST_MINIMAL_SCORES) {
+    ++contexts.scores;
+  }
+}
+
+// Whether the context projection recently forecast the discharge steps better than the line fit.
+static bool is_context_better() {
+  return contexts.scores >= FORECAST_MINIMAL_SCORES && contexts.context_error < contexts.fit_error;
+}
+
+static void attribute_usage(const PendingUsage *pending) {
+  score_forecasts(pending);
+  Fixed prior_rate = overall_rate();
+  if (!prior_rate) {
+    prior_rate = FIXED_ONE;
+  }
+  // Dropping the low 8 bits of the rates keeps the products below within 64 bits.
+  int64_t weights[CONTEXTS_COUNT];
+  int64_t total_weight = 0;
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    Fixed rate = context_rate(context);
+    weights[context] = (int64_t)pending->seconds[context] * ((rate ? rate : prior_rate) >> 8);
+    total_weight += weights[context];
+  }
+  if (!total_weight) {
+    return;
+  }
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    if (!pending->seconds[context]) {
+      continue;
+    }
+    ContextModel *model = &contexts.models[context];
+    model->percent += pending->percent_drop * FIXED_ONE * weights[context] / total_weight;
+    model->seconds += pending->seconds[context];
+    if (model->seconds > CONTEXT_MEMORY_SECONDS) {
+      model->percent /= 2;
+      model->seconds /= 2;
+    }
+  }
+  is_contexts_dirty = true;
+#ifdef DEBUG
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    Fixed rate = context_rate(context);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "context %c%c%c: %d.%02d%%/h over %d minutes",
+            context & CONTEXT_BLUETOOTH ? 'B' : '-', context & CONTEXT_COMPASS ? 'C' : '-',
+            context & CONTEXT_NIGHT ? 'N' : '-', (int)(rate / FIXED_ONE), (int)(rate % FIXED_ONE * 100 / FIXED_ONE),
+            (int)(contexts.models[context].seconds / 60));
+  }
+#endif
+}
+
+// Attribute the pending sample once it is old enough to not be spurious.
+static void commit_usage(time_t current_time) {
+  if (pending_usage.is_pending && current_time - pending_usage.time >= HISTORY_SPURIOUS_SECONDS) {
+    pending_usage.is_pending = false;
+    attribute_usage(&pending_usage);
+  }
+}
+
+// A new discharge sample was added to the history.
+static void usage_sample(time_t current_time, time_t previous_sample_time, int percent_drop) {
+  // A newer sample means the pending one was not spurious.
+  if (pending_usage.is_pending) {
+    pending_usage.is_pending = false;
+    attribute_usage(&pending_usage);
+  }
+  account_usage(current_time);
+  // If we were not running for some of the time, assume the current context was active.
+  int32_t missing_seconds = current_time - previous_sample_time;
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    missing_seconds -= usage_seconds[context];
+  }
+  if (missing_seconds > 0) {
+    struct tm *current_tm = localtime(&current_time);
+    usage_seconds[usage_flags | (is_night_hour(current_tm->tm_hour) ? CONTEXT_NIGHT : 0)] += missing_seconds;
+  }
+  pending_usage = (PendingUsage){ .is_pending = true, .time = current_time, .percent_drop = percent_drop,
+                                  .forecast = forecast };
+  memcpy(pending_usage.seconds, usage_seconds, sizeof(usage_seconds));
+  memset(usage_seconds, 0, sizeof(usage_seconds));
+  forecast = (Forecast){ fit_seconds_per_percent(), usage_flags };
+  schedule_deadline(USAGE_DEADLINE, current_time + HISTORY_SPURIOUS_SECONDS);
+}
+
+// A new discharge segment was started in the history.
+static void usage_segment_start(time_t current_time) {
+  if (pending_usage.is_pending) {
+    pending_usage.is_pending = false;
+    attribute_usage(&pending_usage);
+  }
+  account_usage(current_time);
+  memset(usage_seconds, 0, sizeof(usage_seconds));
+  forecast = (Forecast){ fit_seconds_per_percent(), usage_flags };
+}
+
+// The newest history sample turned out to be spurious.
+static void usage_spurious_sample() {
+  if (pending_usage.is_pending) {
+    pending_usage.is_pending = false;
+    for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+      usage_seconds[context] += pending_usage.seconds[context];
+    }
+    forecast = pending_usage.forecast;
+  }
+}
+
+// The expected rate in percents per hour during the day or night with the given context flags, or 0
+// if we don't know enough.
+static Fixed projected_rate(int flags, bool is_night) {
+  int64_t seconds = 0;
+  int64_t compass_seconds = 0;
+  for (int context = 0; context < CONTEXTS_COUNT; ++context) {
+    seconds += contexts.models[context].seconds;
+    if (context & CONTEXT_COMPASS) {
+      compass_seconds += contexts.models[context].seconds;
+    }
+  }
+  int context = (flags & CONTEXT_BLUETOOTH) | (is_night ? CONTEXT_NIGHT : 0);
+  if (contexts.models[context].seconds < CONTEXT_MINIMAL_SECONDS) {
+    return 0;
+  }
+  Fixed rate = context_rate(context);
+  Fixed compass_rate = context_rate(context | CONTEXT_COMPASS);
+  if (compass_rate) {
+    rate += (compass_rate - rate) * compass_seconds / seconds;
+  }
+  return rate;
+}
+
+// Predict the seconds it would take to drain the given percents starting at the given time, with the
+// given context flags.
+static bool context_predict(int flags, time_t start_time, int percent, int32_t *seconds) {
+  Fixed rates[2] = { projected_rate(flags, false), projected_rate(flags, true) };
+  if (rates[0] <= 0 || rates[1] <= 0) {
+    return false;
+  }
+  struct tm *start_tm = localtime(&start_time);
+  int hour = start_tm->tm_hour;
+  int32_t step_seconds = 3600 - start_tm->tm_min * 60 - start_tm->tm_sec;
+  Fixed remaining_percent = percent * FIXED_ONE;
+  *seconds = 0;
+  // Whole days all drain the same, so after the first midnight we skip over them at once.
+  Fixed day_percent = (24 - (NIGHT_START_HOUR - NIGHT_END_HOUR)) * rates[1]
+                    + (NIGHT_START_HOUR - NIGHT_END_HOUR) * rates[0];
+  for (int which_hour = 0; which_hour < CONTEXT_MAXIMAL_HOURS; ++which_hour) {
+    if (which_hour && !hour && remaining_percent > day_percent) {
+      int days = (remaining_percent - 1) / day_percent;
+      if (days > (CONTEXT_MAXIMAL_HOURS - which_hour) / 24) {
+        days = (CONTEXT_MAXIMAL_HOURS - which_hour) / 24;
+      }
+      remaining_percent -= days * day_percent;
+      *seconds += days * 24 * 3600;
+      which_hour += days * 24;
+      if (which_hour >= CONTEXT_MAXIMAL_HOURS) {
+        break;
+      }
+    }
+    Fixed rate = rates[is_night_hour(hour)];
+    Fixed step_percent = (int64_t)rate * step_seconds / 3600;
+    if (step_percent >= remaining_percent) {
+      *seconds += (int64_t)remaining_percent * step_seconds / step_percent;
+      return true;
+    }
+    remaining_percent -= step_percent;
+    *seconds += step_seconds;
+    step_seconds = 3600;
+    hour = (hour + 1) % 24;
+  }
+  return true;
+}
+
+static void init_usage_contexts() {
+  usage_time = time(NULL);
+  Contexts record;
+  int size = persist_read_data(PERSIST_CONTEXTS_KEY, &record, sizeof(record));
+  if (size == sizeof(record) && record.version == PERSIST_CONTEXTS_VERSION) {
+    contexts = record;
+  } else if (size == PERSIST_CONTEXTS_VERSION_1_SIZE && record.version == 1) {
+    // The forecasts start unscored, so the contexts must prove themselves again.
+    memcpy(contexts.models, record.models, sizeof(contexts.models));
+  }
+}
+
+static void write_usage_contexts() {
+  persist_write_data(PERSIST_CONTEXTS_KEY, &contexts, sizeof(contexts));
+  is_contexts_dirty = false;
+}
+
+static void deinit_usage_contexts() {
+  if (is_contexts_dirty) {
+    write_usage_contexts();
+  }
+}
+
+//// Record battery history.
+
+// Whether the history changed since we last wrote it.
+static bool is_history_dirty;
+
+static void write_history() {
+  persist_write_data(PERSIST_HISTORY_KEY, &history, sizeof(history));
+  is_history_dirty = false;
+}
+
+static void push_history(time_t current_time, int percent, bool is_segment_start) {
+  time_t time = current_time;
+  HistorySample sample = { .is_segment_start = is_segment_start };
+  if (history.count) {
+    // Keep the reconstructed times exact by rounding the stored time rather than only the delta.
+    int minutes = (current_time - (time_t)history.newest_time + 30) / 60;
+    if (minutes > HISTORY_MAX_MINUTES) {
+      minutes = HISTORY_MAX_MINUTES;
+      sample.is_segment_start = is_segment_start = true;
+    }
+    sample.minutes = minutes;
+    sample.percent_delta = percent - history.newest_percent;
+    time = history.newest_time + minutes * 60;
+    history.newest = next_history_index(history.newest);
+  }
+  if (history.count < HISTORY_SAMPLES_COUNT) {
+    ++history.count;
+  }
+  time_t previous_time = history.newest_time;
+  int previous_percent = history.newest_percent;
+  history.samples[history.newest] = sample;
+  history.newest_time = time;
+  history.newest_percent = percent;
+  if (is_segment_start) {
+    regression_start(history.newest, time, percent);
+    usage_segment_start(current_time);
+  } else {
+    regression_push(history.newest, time, percent);
+    usage_sample(current_time, previous_time, previous_percent - percent);
+  }
+  is_history_dirty = true;
+}
+
+// Remove the newest sample, which turned out to be spurious.
+static void pop_history() {
+  const HistorySample *sample = &history.samples[history.newest];
+  history.newest_time -= sample->minutes * 60;
+  history.newest_percent -= sample->percent_delta;
+  history.newest = previous_history_index(history.newest);
+  --history.count;
+  // This is rare enough that it isn't worth undoing just the newest sample in O(1).
+  regression_restore();
+  usage_spurious_sample();
+  is_history_dirty = true;
+}
+
+static void record_battery_history(time_t current_time) {
+  bool is_plugged = battery_charge_state.is_plugged;
+  bool was_unplugged = was_plugged && !is_plugged;
+  was_plugged = is_plugged;
+  if (is_plugged) {
+    return;
+  }
+  int percent = battery_charge_state.charge_percent;
+  // TRICKY: Spurious readings (0%?!?!) are not always fast enough to be rejected below, but they are
+  // always followed by the real reading within seconds.
+  if (!was_unplugged && history.count > 1 && !history.samples[history.newest].is_segment_start
+   && percent > history.newest_percent && current_time - (time_t)history.newest_time < HISTORY_SPURIOUS_SECONDS) {
+    pop_history();
+    if (percent == history.newest_percent) {
+      return;
+    }
+  }
+  if (!history.count || was_unplugged || percent > history.newest_percent) {
+    push_history(current_time, percent, true);
+    return;
+  }
+  if (percent == history.newest_percent) {
+    return;
+  }
+  const Predictor *predictor = &predictors[DISCHARGE_PREDICTOR];
+  time_t step_seconds_per_percent = (current_time - (time_t)history.newest_time) / (history.newest_percent - percent);
+  if (step_seconds_per_percent < predictor->minimal_seconds_per_percent / FIXED_ONE) {
+    // A spurious reading (0%?!?!), which will soon be followed by the real one.
+    return;
+  }
+  // A gap in the history (say, while running another app), so the new sample can't be trusted.
+  push_history(current_time, percent, step_seconds_per_percent >= predictor->maximal_seconds_per_percent / FIXED_ONE);
+}
+
+static void init_battery_history() {
+  History record;
+  if (persist_read_data(PERSIST_HISTORY_KEY, &record, sizeof(record)) == sizeof(record)
+   && record.version == PERSIST_HISTORY_VERSION) {
+    history = record;
+    regression_restore();
+  }
+}
+
+static void deinit_battery_history() {
+  if (is_history_dirty) {
+    write_history();
+  }
+}
+
+//// Checkpoint.
+
+// Write what we learned since the previous checkpoint, if it is worth it and allowed already.
+static void checkpoint(time_t current_time) {
+  bool is_predictors_dirty = is_worth_checkpoint();
+  if (!is_predictors_dirty && !is_history_dirty && !is_contexts_dirty) {
+    return;
+  }
+  if (current_time - checkpoint_time < PREDICTORS_CHECKPOINT_SECONDS) {
+    schedule_deadline(CHECKPOINT_DEADLINE, checkpoint_time + PREDICTORS_CHECKPOINT_SECONDS);
+    return;
+  }
+  if (is_predictors_dirty) {
+    write_predictors(current_time);
+  }
+  if (is_history_dirty) {
+    write_history();
+  }
+  if (is_contexts_dirty) {
+    write_usage_contexts();
+  }
+  checkpoint_time = current_time;
+}
+
+//// Predict time left.
+
+// Whether the battery was charging at the previous update.
+static bool was_charging;
+
+// Learn the rate of a step between the given percents in each band it covers.
+static void update_band_rates(Predictor *predictor, int from_percent, int to_percent,
+                              Fixed step_seconds_per_percent) {
+  int low_percent = from_percent < to_percent ? from_percent : to_percent;
+  int high_percent = from_percent < to_percent ? to_percent : from_percent;
+  for (int which_band = low_percent / PREDICTOR_BAND_PERCENT;
+       which_band * PREDICTOR_BAND_PERCENT < high_percent && which_band < PREDICTOR_BANDS_COUNT; ++which_band) {
+    Fixed *band_seconds_per_percent = &predictor->band_seconds_per_percent[which_band];
+    if (*band_seconds_per_percent > predictor->minimal_seconds_per_percent
+     && *band_seconds_per_percent < predictor->maximal_seconds_per_percent) {
+      // The same moving average as the overall rate.
+      *band_seconds_per_percent += (step_seconds_per_percent - *band_seconds_per_percent) / 10;
+    } else {
+      *band_seconds_per_percent = step_seconds_per_percent;
+    }
+  }
+}
+
+// The seconds (with 8 fractional bits) it takes to go through the percents between the given ones,
+// summing the rate of each band (or the overall rate, for bands we did not learn yet).
+static int32_t band_seconds(const Predictor *predictor, int low_percent, int high_percent) {
+  int32_t seconds = 0;
+  for (int which_band = low_percent / PREDICTOR_BAND_PERCENT;
+       which_band * PREDICTOR_BAND_PERCENT < high_percent && which_band < PREDICTOR_BANDS_COUNT; ++which_band) {
+    int band_low_percent = which_band * PREDICTOR_BAND_PERCENT;
+    int band_high_percent = band_low_percent + PREDICTOR_BAND_PERCENT;
+    int percents = (high_percent < band_high_percent ? high_percent : band_high_percent)
+                 - (low_percent > band_low_percent ? low_percent : band_low_percent);
+    Fixed seconds_per_percent = predictor->band_seconds_per_percent[which_band]
+                              ? predictor->band_seconds_per_percent[which_band]
+                              : predictor->seconds_per_percent;
+    seconds += percents * (seconds_per_percent >> 8);
+  }
+  return seconds;
 }
 
 static void update_predictor(time_t current_time) {
   int current_percent =  battery_charge_state.charge_percent;
   // TRICKY: If we are charging and at 100%, we'll be switching to discharging soon, and we'll be
   // at a known state, so capture the current state as the base state of the discharge predictor.
-  // The base time will be only one minute off, which is negligible.
-  if (battery_charge_state.is_charging && current_percent == 100) {
+  // Unplugging the charger is a battery event too, so if we are still at 100% then, the base time
+  // is exactly when we started discharging.
+  if (current_percent == 100
+   && (battery_charge_state.is_charging
+    || (predictors[DISCHARGE_PREDICTOR].previous_time && predictors[DISCHARGE_PREDICTOR].previous_percent == 100))) {
     predictors[DISCHARGE_PREDICTOR].previous_time = current_time;
     predictors[DISCHARGE_PREDICTOR].previous_percent = current_percent;
   }
-  WhichPredictor which_predictor = battery_charge_state.is_charging ? CHARGE_PREDICTOR : DISCHARGE_PREDICTOR;
+  // TRICKY: The watch stops saying it is charging when it reports 100%, so that reading is the end
+  // of the last (and slowest) step of the charge, rather than a discharge reading.
+  bool is_charge_end = was_charging && !battery_charge_state.is_charging && current_percent == 100;
+  was_charging = battery_charge_state.is_charging;
+  bool is_charging = battery_charge_state.is_charging || is_charge_end;
+  WhichPredictor which_predictor = is_charging ? CHARGE_PREDICTOR : DISCHARGE_PREDICTOR;
   Predictor *predictor = &predictors[which_predictor];
   time_t time_delta = current_time - predictor->previous_time;
   int percents_delta = current_percent - predictor->previous_percent;
   if (time_delta <= 0 || !percents_delta) {
     return;
   }
-  if ((battery_charge_state.is_charging && percents_delta <= 0)
-   || (!battery_charge_state.is_charging && percents_delta >= 0)) {
+  if ((is_charging && percents_delta <= 0) || (!is_charging && percents_delta >= 0)) {
     // Makes no sense; ignore for purpose of updating dis/charge speed.
   } else {
     if (percents_delta < 0) {
       percents_delta = -percents_delta;
     }
-    if (predictor->previous_time) {
-      double hours_delta = time_delta / 3600.0;
-      double step_hours_per_percent = hours_delta / percents_delta;
-      // TRICKY: Ignore completely unreasonable values that result from switching between dis/charging.
-      // Simply clearing the base time when switching between modes doesn't work because it seems that
-      // we get spurious readings with wildly wrong values (0%?!?!) interspersed between the real ones.
-      if (step_hours_per_percent > predictor->minimal_hours_per_percent
-       && step_hours_per_percent < predictor->maximal_hours_per_percent) {
-        if (predictor->hours_per_percent > predictor->minimal_hours_per_percent
-         && predictor->hours_per_percent < predictor->maximal_hours_per_percent) {
-          predictor->hours_per_percent = 0.9 * predictor->hours_per_percent + 0.1 * step_hours_per_percent;
+    // TRICKY: Ignore completely unreasonable values that result from switching between dis/charging.
+    // Simply clearing the base time when switching between modes doesn't work because it seems that
+    // we get spurious readings with wildly wrong values (0%?!?!) interspersed between the real ones.
+    // Checking the whole seconds first also ensures the fixed point step below does not overflow.
+    if (predictor->previous_time
+     && time_delta / percents_delta < predictor->maximal_seconds_per_percent / FIXED_ONE) {
+      Fixed step_seconds_per_percent = (Fixed)(time_delta / percents_delta) * FIXED_ONE
+                                     + (Fixed)(time_delta % percents_delta) * FIXED_ONE / percents_delta;
+      if (step_seconds_per_percent > predictor->minimal_seconds_per_percent
+       && step_seconds_per_percent < predictor->maximal_seconds_per_percent) {
+        if (predictor->seconds_per_percent > predictor->minimal_seconds_per_percent
+         && predictor->seconds_per_percent < predictor->maximal_seconds_per_percent) {
+          // A moving average: 0.9 of the old value and 0.1 of the new step.
+          predictor->seconds_per_percent += (step_seconds_per_percent - predictor->seconds_per_percent) / 10;
         } else {
-          predictor->hours_per_percent = step_hours_per_percent;
+          predictor->seconds_per_percent = step_seconds_per_percent;
         }
+        update_band_rates(predictor, predictor->previous_percent, current_percent, step_seconds_per_percent);
+        record_telemetry(PREDICTOR_TELEMETRY, which_predictor, predictor->seconds_per_percent / FIXED_ONE);
       }
     }
   }
@@ -434,10 +2582,79 @@ static void update_predictor(time_t current_time) {
   predictor->previous_percent = current_percent;
 }
 
-static char *format_predictor(time_t current_time) {
+// When the time left text shown for the given exact remaining seconds (with 8 fractional bits)
+// changes, that is, when the remaining seconds drop below the rounding threshold of the shown hours
+// (or minutes).
+static time_t change_time(time_t current_time, int32_t exact_difference_seconds) {
+  int32_t threshold_seconds;
+  if (exact_difference_seconds >= (3600 << 8)) {
+    int rounded_difference_hours = (exact_difference_seconds + (1800 << 8)) / (3600 << 8);
+    threshold_seconds = rounded_difference_hours * (3600 << 8) - (1800 << 8);
+    if (threshold_seconds < (3600 << 8)) {
+      threshold_seconds = 3600 << 8;
+    }
+  } else {
+    int rounded_difference_minutes = (exact_difference_seconds + (30 << 8)) / (60 << 8);
+    threshold_seconds = rounded_difference_minutes * (60 << 8) - (30 << 8);
+    if (threshold_seconds < 0) {
+      threshold_seconds = 0;
+    }
+  }
+  time_t next_time = current_time + (exact_difference_seconds - threshold_seconds) / (1 << 8) + 1;
+#ifdef DEBUG
+  // The debug texts show the time since the last measurement, so keep them roughly current.
+  if (next_time > current_time + 60) {
+    next_time = current_time + 60;
+  }
+#endif
+  return next_time;
+}
+
+// Predict the seconds (with 8 fractional bits) until the battery is empty, or full when charging.
+// Returns NULL if there is a prediction, or else the text to show instead.
+static const char *predict_time_left(time_t current_time, int32_t *exact_difference_seconds) {
   WhichPredictor which_predictor = battery_charge_state.is_charging ? CHARGE_PREDICTOR : DISCHARGE_PREDICTOR;
+  const Predictor *predictor = &predictors[which_predictor];
+  Predictor discharge_regression_predictor;
+  if (which_predictor == DISCHARGE_PREDICTOR && regression_predictor(&discharge_regression_predictor)) {
+    predictor = &discharge_regression_predictor;
+  }
+  if (!predictor->previous_time && !predictor->seconds_per_percent) {
+    return " ?! ";
+  }
+  if (!predictor->previous_time) {
+    return " ?  ";
+  }
+  if (!predictor->seconds_per_percent) {
+    return "  ! ";
+  }
+  int low_percent = which_predictor == DISCHARGE_PREDICTOR ? 0 : predictor->previous_percent;
+  int high_percent = which_predictor == DISCHARGE_PREDICTOR ? predictor->previous_percent : 100;
+  if (low_percent >= high_percent) {
+    return " 00 ";
+  }
+  time_t time_since_previous_time = current_time - predictor->previous_time;
+  // TRICKY: Multiplying the full Q16.16 rate by up to 100 percent would overflow, so we compute the
+  // remaining time in seconds with only 8 fractional bits. This is still way more precise than the
+  // displayed minutes, and anything up to 48 days still fits in 32 bits. Anything longer than that
+  // is way more than the 100 percents times the maximal 4 hours per percent, so we clamp it.
+  if (time_since_previous_time > (1 << 22)) {
+    time_since_previous_time = 1 << 22;
+  }
+  *exact_difference_seconds = band_seconds(predictor, low_percent, high_percent)
+                            - (int32_t)time_since_previous_time * (1 << 8);
+  int32_t context_seconds;
+  if (which_predictor == DISCHARGE_PREDICTOR && is_context_better()
+   && context_predict(usage_flags, predictor->previous_time, predictor->previous_percent, &context_seconds)) {
+    *exact_difference_seconds = (context_seconds - (int32_t)time_since_previous_time) * (1 << 8);
+  }
+  return NULL;
+}
+
+static const char *format_predictor(time_t current_time) {
+  time_left_change_time = 0;
 #ifdef DEBUG
-  char direction = which_predictor == CHARGE_PREDICTOR ? '+' : '-';
+  char direction = battery_charge_state.is_charging ? '+' : '-';
   static char old_text[14];
   time_t old_time = todo_old_time > 100 ? current_time - todo_old_time : todo_old_time;
   snprintf(old_text, sizeof(old_text), "%02d:%02d:%02d%c%d",
@@ -448,147 +2665,150 @@ static char *format_predictor(time_t current_time) {
            todo_old_percent == 100 ? 99 : todo_old_percent);
   set_text(TODO_OLD_TEXT, old_text);
   static char new_text[14];
-  double charge_percent_per_hour = predictors[CHARGE_PREDICTOR].hours_per_percent
-                                 ? 1.0 / predictors[CHARGE_PREDICTOR].hours_per_percent
+  // Hundredths of a percent per hour, that is 360000 divided by the seconds per percent.
+  Fixed charge_seconds_per_percent = predictors[CHARGE_PREDICTOR].seconds_per_percent >> 8;
+  int charge_percent_per_hour = charge_seconds_per_percent ? (360000 << 8) / charge_seconds_per_percent : 0;
+  Fixed discharge_seconds_per_percent = predictors[DISCHARGE_PREDICTOR].seconds_per_percent >> 8;
+  int discharge_percent_per_hour = discharge_seconds_per_percent
+                                 ? (360000 << 8) / discharge_seconds_per_percent
                                  : 0;
-  double discharge_percent_per_hour = predictors[DISCHARGE_PREDICTOR].hours_per_percent
-                                    ? 1.0 / predictors[DISCHARGE_PREDICTOR].hours_per_percent
-                                    : 0;
   snprintf(new_text, sizeof(new_text), "+%d.%02d-%d.%02d",
-           (int)(charge_percent_per_hour),
-           (int)((charge_percent_per_hour - (int)(charge_percent_per_hour)) * 100),
-           (int)(discharge_percent_per_hour),
-           (int)((discharge_percent_per_hour - (int)(discharge_percent_per_hour)) * 100));
+           charge_percent_per_hour / 100, charge_percent_per_hour % 100,
+           discharge_percent_per_hour / 100, discharge_percent_per_hour % 100);
   set_text(TODO_NEW_TEXT, new_text);
 #endif
-  static char predictor_text[] = "0+00";
-  const Predictor *predictor = &predictors[which_predictor];
-  char no_time = ' ';
-  if (!predictor->previous_time) {
-      no_time = '?';
+  int32_t exact_difference_seconds;
+  const char *no_prediction_text = predict_time_left(current_time, &exact_difference_seconds);
+  if (no_prediction_text) {
+    return no_prediction_text;
   }
-  char no_hours_per_percent = ' ';
-  if (!predictor->hours_per_percent) {
-      no_hours_per_percent = '!';
-  }
-  if (no_time != ' ' || no_hours_per_percent != ' ') {
-    snprintf(predictor_text, sizeof(predictor_text), " %c%c ", no_time, no_hours_per_percent);
-    return predictor_text;
-  }
-  int target_percent = which_predictor == DISCHARGE_PREDICTOR ? 0 : 100;
-  int difference_percent = target_percent - predictor->previous_percent;
-  if (difference_percent < 0) {
-    difference_percent = -difference_percent;
-  }
-  if (!difference_percent) {
-      snprintf(predictor_text, sizeof(predictor_text), " 00 ");
-      return predictor_text;
-  }
-  time_t time_since_previous_time = current_time - predictor->previous_time;
-  // TRICKY: Since we'll be showing only hours, no need to update more than once in 20 minutes.
-  if (time_since_previous_time > 3600 + 1200) {
-    prediction_update_frequency = 1200;
-  } else {
-    prediction_update_frequency = 0;
-  }
-  double hours_since_previous_time = time_since_previous_time / 3600.0;
-  double exact_difference_hours = difference_percent * predictor->hours_per_percent - hours_since_previous_time;
-  if (exact_difference_hours >= 1.0) {
-    int floor_difference_days = (int)(exact_difference_hours / 24.0);
-    int rounded_difference_hours = (int)(exact_difference_hours - floor_difference_days * 24.0 + 0.5);
+  static char predictor_text[] = "0+00";
+  if (exact_difference_seconds >= (3600 << 8)) {
+    int floor_difference_days = exact_difference_seconds / (86400 << 8);
+    int rounded_difference_hours = (exact_difference_seconds - floor_difference_days * (86400 << 8) + (1800 << 8))
+                                 / (3600 << 8);
     if (rounded_difference_hours >= 24) {
       rounded_difference_hours -= 24;
       floor_difference_days += 1;
     }
-    snprintf(predictor_text, sizeof(predictor_text), "%1d+%02d", floor_difference_days, rounded_difference_hours);
-  } else if (exact_difference_hours >= 0) {
-    int rounded_difference_minutes = (int)(exact_difference_hours * 60.0 + 0.5);
-    snprintf(predictor_text, sizeof(predictor_text), "0:%02d", rounded_difference_minutes);
+    format_days_hours(predictor_text, floor_difference_days, rounded_difference_hours);
+  } else if (exact_difference_seconds >= 0) {
+    int rounded_difference_minutes = (exact_difference_seconds + (30 << 8)) / (60 << 8);
+    format_minutes(predictor_text, rounded_difference_minutes);
   } else {
-    snprintf(predictor_text, sizeof(predictor_text), " ?? ");
+    // This will not change until the next battery event.
+    return " ?? ";
   }
+  time_left_change_time = change_time(current_time, exact_difference_seconds);
   return predictor_text;
 }
 
 //// Text updates.
 
-static void update_time_left(time_t tick_time) {
-  update_predictor(tick_time);
-  static time_t last_format_time;
-  if (tick_time - last_format_time < prediction_update_frequency) {
-    return;
-  }
-  char *time_left_text = format_predictor(last_format_time = tick_time);
+static bool is_active_profile();
+
+static void update_time_left(time_t current_time) {
+  const char *time_left_text = format_predictor(current_time);
   // APP_LOG(APP_LOG_LEVEL_DEBUG, ">>%s<<", time_left_text);
   if (battery_charge_state.is_charging) {
-    set_text(LONG_TIME_LEFT_TEXT, "");
-    set_text(SHORT_TIME_LEFT_TEXT, "");
-    set_text(CHARGE_TIME_LEFT_TEXT, time_left_text);
+    set_styled_text(TIME_LEFT_TEXT, CHARGE_TIME_LEFT_STYLE, time_left_text);
   } else if(battery_charge_state.charge_percent < 50) {
-    set_text(LONG_TIME_LEFT_TEXT, "");
-    set_text(SHORT_TIME_LEFT_TEXT, time_left_text);
-    set_text(CHARGE_TIME_LEFT_TEXT, "");
+    set_styled_text(TIME_LEFT_TEXT, SHORT_TIME_LEFT_STYLE, time_left_text);
   } else {
-    set_text(LONG_TIME_LEFT_TEXT, time_left_text);
-    set_text(SHORT_TIME_LEFT_TEXT, "");
-    set_text(CHARGE_TIME_LEFT_TEXT, "");
-  }
-}
-
-static void upcase(char *text) {
-  for (char *c = text; *c; ++c) {
-    if ('a' <= *c && *c <= 'z') {
-      *c -= 'a';
-      *c += 'A';
-    }
+    set_styled_text(TIME_LEFT_TEXT, LONG_TIME_LEFT_STYLE, time_left_text);
   }
+  // When nobody is looking, the time left is only shown anew on battery events (which may plug the
+  // charger or cross into another style), until the governor resumes the active profile.
+  schedule_deadline(TIME_LEFT_DEADLINE, is_active_profile() ? time_left_change_time : 0);
 }
 
-static void increment_two_digits(char *digits) {
-  if (digits[1] == '9') {
-    digits[1] = '0';
-    ++digits[0];
-  } else {
-    ++digits[1];
-  }
+// Learn from a battery event and show the new prediction.
+static void update_battery_prediction(time_t current_time) {
+  record_battery_history(current_time);
+  update_predictor(current_time);
+  checkpoint(current_time);
+  update_time_left(current_time);
 }
 
-static void update_date(struct tm* tick_time) {
+static void update_date(time_t current_time) {
+  struct tm *tick_time = localtime(&current_time);
   static char date_text[] = "0000.00.00";
-  strftime(date_text, sizeof(date_text), "%Y.%m.%d", tick_time);
+  format_date(date_text, tick_time);
   set_text(DATE_TEXT, date_text);
   
-  static char date_names_text[] = "Xxx.Xxx";
-  strftime(date_names_text, sizeof(date_names_text), "%a%n%b", tick_time);
-  upcase(date_names_text);
+  static char date_names_text[] = "XXX.XXX";
+  format_date_names(date_names_text, tick_time);
   set_text(DATE_NAMES_TEXT, date_names_text);
   
   static char work_week_text[] = "00";
-  strftime(work_week_text, sizeof(work_week_text), "%U", tick_time);
-  // No way to tell strftime to use 1-based workweek...
-  increment_two_digits(work_week_text);
-  // Abuse the 12/24 setting to force an additional 1w offset.
-  if (clock_is_24h_style()) {
-    increment_two_digits(work_week_text);
-  }
+  // The work week is 1-based. Abuse the 12/24 setting to force an additional 1w offset.
+  format_work_week(work_week_text, tick_time, clock_is_24h_style() ? 2 : 1);
   set_text(WORK_WEEK_TEXT, work_week_text);
+  
+  // TRICKY: Letting mktime normalize the next day's midnight gets it right even on the days the
+  // clock moves for daylight saving time.
+  tick_time->tm_mday += 1;
+  tick_time->tm_hour = tick_time->tm_min = tick_time->tm_sec = 0;
+  tick_time->tm_isdst = -1;
+  schedule_deadline(DATE_DEADLINE, mktime(tick_time));
 }
 
+// The minute tick only shows the time; everything else runs by the deadlines.
+static void commit_events(bool is_frame_due);
+
 static void update_time(struct tm* tick_time, TimeUnits units_changed) {
-  if(units_changed >= DAY_UNIT) {
-    update_date(tick_time); 
-  }
-  
-  static char time_text[6];
-  strftime(time_text, sizeof(time_text), "%H:%M", tick_time);
+  // This renders a frame anyway, so show whatever is pending in it as well.
+  commit_events(true);
+  static char time_text[] = "00:00";
+  format_time(time_text, tick_time);
   set_text(TIME_TEXT, time_text);
-  
-  update_time_left(mktime(tick_time));
 }
 
+static void update_profile(time_t current_time);
+
+static void run_deadlines(void *data) {
+  uint32_t start_ms = clock_ms();
+  deadline_timer = NULL;
+  time_t current_time = time(NULL);
+  for (WhichDeadline which_deadline = 0; which_deadline < DEADLINES_COUNT; ++which_deadline) {
+    if (!deadlines[which_deadline] || deadlines[which_deadline] > current_time) {
+      continue;
+    }
+    deadlines[which_deadline] = 0;
+    switch (which_deadline) {
+      case DATE_DEADLINE:
+        update_date(current_time);
+        break;
+      case TIME_LEFT_DEADLINE:
+        update_time_left(current_time);
+        break;
+      case CHECKPOINT_DEADLINE:
+        checkpoint(current_time);
+        break;
+      case USAGE_DEADLINE:
+        commit_usage(current_time);
+        break;
+      case PROFILE_DEADLINE:
+        update_profile(current_time);
+        break;
+      case DEADLINES_COUNT:
+        break;
+    }
+  }
+  arm_deadline_timer();
+  record_handler(DEADLINES_HANDLER, start_ms);
+}
+
+#ifndef NO_COMPASS
+
+// How far (in degrees) the heading must go past the edge of the shown direction's sector before we
+// switch to the neighbouring direction. Without this, pointing near an edge flips between the two.
+#define COMPASS_HYSTERESIS_DEGREES 8
+
 static void update_compass(CompassHeadingData heading_data) {
-  static char *direction_text[] = { "N", "NE", "E", "SE", "S", "SW", "W", "NW", "N" };
+  static char *direction_text[] = { "N", "NE", "E", "SE", "S", "SW", "W", "NW" };
   static char *last_heading_text = NULL;
+  static int last_direction = -1; // The shown direction, or -1 if not showing one.
   char *current_heading_text = NULL;
   bool is_two_letter = false;
   switch (heading_data.compass_status) {
@@ -602,69 +2822,666 @@ static void update_compass(CompassHeadingData heading_data) {
     case CompassStatusCalibrated:
       {
         int angle = 360 - TRIGANGLE_TO_DEG(heading_data.true_heading);
-        int direction = (angle * 8 + 180) / 360;
+        int direction = (angle * 8 + 180) / 360 % 8;
+        if (last_direction >= 0 && direction != last_direction) {
+          int offset = (angle - last_direction * 45 + 360 + 180) % 360 - 180;
+          if (offset < 0) {
+            offset = -offset;
+          }
+          // That is, offset <= 22.5 + COMPASS_HYSTERESIS_DEGREES.
+          if (2 * offset <= 45 + 2 * COMPASS_HYSTERESIS_DEGREES) {
+            direction = last_direction;
+          }
+        }
+        last_direction = direction;
         is_two_letter = direction % 2;
         current_heading_text = direction_text[direction];
       }
       break;
   }
+  if (heading_data.compass_status != CompassStatusCalibrated) {
+    last_direction = -1;
+  }
   if (current_heading_text != last_heading_text) {
-    if (is_two_letter) {
-      set_text(COMPASS_ONE_LETTER_TEXT, "");
-      set_text(COMPASS_TWO_LETTER_TEXT, current_heading_text);
-    } else {
-      set_text(COMPASS_ONE_LETTER_TEXT, current_heading_text);
-      set_text(COMPASS_TWO_LETTER_TEXT, "");
-    }
+    set_styled_text(COMPASS_TEXT, is_two_letter ? TWO_LETTER_COMPASS_STYLE : ONE_LETTER_COMPASS_STYLE,
+                    current_heading_text);
     last_heading_text = current_heading_text;
   }
 }
 
+#endif
+
+//// Event queue.
+
+// TRICKY: The sensor callbacks come in bursts: plugging the charger delivers several battery events,
+// a weak bluetooth connection flaps a few times within seconds, and the compass reports each small
+// heading change. Handling each of them at once would render a frame for each. Instead, they only
+// record the new state here, and the next tick (which renders a frame anyway) commits all of it
+// together. A battery level only moves the bar a little, so it can wait for the minute tick; it is
+// sampled up to a minute late, which is little next to the 15 minutes or more each percent takes.
+// Only what the wearer is looking at can't wait that long: plugging or unplugging the charger, and
+// the compass (which is only on after a wrist flick). These are committed by a short timer instead,
+// unless a seconds burst ticks every second anyway. Bluetooth changes are also debounced, that is,
+// only committed once the connection was stable for a while, so a flap is not shown at all.
+
+// How long to wait for more events before committing those which can't wait for the next tick.
+#define EVENTS_COMMIT_MS 500
+
+// How long the bluetooth connection must be stable before committing its change.
+#define BLUETOOTH_DEBOUNCE_MS (10 * 1000)
+
+// The latest state reported by each callback, which was not committed yet.
+typedef struct {
+  // Whether there is a battery state to commit, and what it is.
+  bool is_battery_pending;
+  BatteryChargeState battery;
+  
+  // Whether there is a (debounced) bluetooth connection state to commit, and what it is.
+  bool is_bluetooth_pending;
+  bool is_bluetooth_connected;
+  
+#ifndef NO_COMPASS
+  // Whether there is a compass heading to commit, and what it is.
+  bool is_compass_pending;
+  CompassHeadingData compass_heading;
+#endif
+  
+  // How many events the above stand for.
+  uint32_t events_count;
+} PendingEvents;
+
+static PendingEvents pending_events;
+
+// The timer committing the pending events, while there are any.
+static AppTimer *commit_timer;
+
+// The timer committing the bluetooth state once it is stable, while it is not.
+static AppTimer *bluetooth_timer;
+
+// The latest reported bluetooth connection state.
+static bool is_bluetooth_connected;
+
+// How many bluetooth events were reported since the connection was last stable.
+static uint32_t bluetooth_events_count;
+
+// How many events the callbacks reported, and how many frames were saved by not rendering each of
+// them at once (by committing them together, in the frame of a tick, or not at all for a flap).
+// Not static so they can be inspected from the outside (e.g. by the host benchmark).
+uint32_t queued_events;
+uint32_t saved_event_frames;
+
+static bool is_seconds_burst();
+
+// Commit the pending events, in the frame of a tick if one is due, or else in a frame of their own.
+static void commit_events(bool is_frame_due) {
+  if (commit_timer) {
+    app_timer_cancel(commit_timer);
+    commit_timer = NULL;
+  }
+  if (!pending_events.is_battery_pending && !pending_events.is_bluetooth_pending
+#ifndef NO_COMPASS
+   && !pending_events.is_compass_pending
+#endif
+     ) {
+    return;
+  }
+  saved_event_frames += pending_events.events_count - (is_frame_due ? 0 : 1);
+  PendingEvents events = pending_events;
+  pending_events = (PendingEvents){ 0 };
+  if (events.is_battery_pending) {
+    battery_update(events.battery);
+  }
+  if (events.is_bluetooth_pending) {
+    update_bluetooth_status(events.is_bluetooth_connected);
+  }
+#ifndef NO_COMPASS
+  if (events.is_compass_pending) {
+    update_compass(events.compass_heading);
+  }
+#endif
+}
+
+static void commit_timer_fired(void *data) {
+  uint32_t start_ms = clock_ms();
+  commit_timer = NULL;
+  commit_events(false);
+  record_handler(EVENTS_HANDLER, start_ms);
+}
+
+// Queue an event for the next tick, or, if it is urgent and that is too far, for the commit timer.
+static void queue_event(bool is_urgent) {
+  ++queued_events;
+  ++pending_events.events_count;
+  if (is_urgent && !is_seconds_burst() && !commit_timer) {
+    commit_timer = app_timer_register(EVENTS_COMMIT_MS, commit_timer_fired, NULL);
+  }
+}
+
+static void queue_battery_event(BatteryChargeState charge_state) {
+  pending_events.is_battery_pending = true;
+  pending_events.battery = charge_state;
+  queue_event(charge_state.is_charging != battery_charge_state.is_charging
+           || charge_state.is_plugged != battery_charge_state.is_plugged);
+}
+
+#ifndef NO_COMPASS
+static void queue_compass_event(CompassHeadingData heading_data) {
+  pending_events.is_compass_pending = true;
+  pending_events.compass_heading = heading_data;
+  queue_event(true);
+}
+#endif
+
+static void bluetooth_timer_fired(void *data) {
+  uint32_t start_ms = clock_ms();
+  bluetooth_timer = NULL;
+  // A flap which ended where it started changes nothing.
+  if (is_bluetooth_connected == layer_get_hidden(images[BLUETOOTH_IMAGE].layer)) {
+    pending_events.is_bluetooth_pending = true;
+    pending_events.is_bluetooth_connected = is_bluetooth_connected;
+    pending_events.events_count += bluetooth_events_count;
+    commit_events(false);
+  } else {
+    saved_event_frames += bluetooth_events_count;
+  }
+  bluetooth_events_count = 0;
+  record_handler(BLUETOOTH_HANDLER, start_ms);
+}
+
+static void queue_bluetooth_event(bool is_connected) {
+  ++queued_events;
+  ++bluetooth_events_count;
+  is_bluetooth_connected = is_connected;
+  if (!bluetooth_timer || !app_timer_reschedule(bluetooth_timer, BLUETOOTH_DEBOUNCE_MS)) {
+    bluetooth_timer = app_timer_register(BLUETOOTH_DEBOUNCE_MS, bluetooth_timer_fired, NULL);
+  }
+}
+
+static void deinit_events() {
+  if (commit_timer) {
+    app_timer_cancel(commit_timer);
+    commit_timer = NULL;
+  }
+  if (bluetooth_timer) {
+    app_timer_cancel(bluetooth_timer);
+    bluetooth_timer = NULL;
+  }
+}
+
+//// Compass duty cycle.
+
+// TRICKY: Keeping the magnetometer on all the time costs a noticeable amount of battery, for a
+// heading nobody looks at most of the time. Instead we turn it on for a short window after launch
+// and after each wrist flick (accelerometer tap), and keep showing the last heading otherwise.
+
+#ifndef NO_COMPASS
+
+// How long to keep the compass on after a wrist flick.
+#define COMPASS_WINDOW_MS (15 * 1000)
+
+// The timer turning the compass off, while it is on.
+static AppTimer *compass_timer;
+
+static void stop_compass(void *data) {
+  compass_timer = NULL;
+  compass_service_unsubscribe();
+  update_usage_flag(CONTEXT_COMPASS, false);
+  record_telemetry(COMPASS_TELEMETRY, false, 0);
+}
+
+static void start_compass() {
+  if (compass_timer) {
+    app_timer_reschedule(compass_timer, COMPASS_WINDOW_MS);
+    return;
+  }
+  compass_service_set_heading_filter(10 * (TRIG_MAX_ANGLE / 360));
+  compass_service_subscribe(&queue_compass_event);
+  compass_timer = app_timer_register(COMPASS_WINDOW_MS, stop_compass, NULL);
+  update_usage_flag(CONTEXT_COMPASS, true);
+  record_telemetry(COMPASS_TELEMETRY, true, 0);
+}
+
+// Turn the compass off now, if it is on.
+static void cancel_compass() {
+  if (compass_timer) {
+    app_timer_cancel(compass_timer);
+    stop_compass(NULL);
+  }
+}
+
+#else
+
+// There is no compass to turn on or off.
+static void start_compass() {
+}
+
+static void cancel_compass() {
+}
+
+#endif
+
+//// Seconds burst.
+
+// TRICKY: Ticking every second all the time would cost far more than the minute tick, for seconds
+// nobody looks at. Instead a wrist flick shows the seconds for a few seconds, ticking every second
+// meanwhile, and then goes back to minute ticks. Each second only the seconds text is damaged, and
+// it is right under the time, but clear of the rows of the time's sprites (see sprites_rect), so
+// neither the time nor the rest of the frame is redrawn. The seconds shown each day are capped, so
+// flicking over and over can't drain the battery; the budget is persisted when each burst ends, so
+// relaunching (or crashing) does not reset it either.
+
+// How long a wrist flick shows the seconds.
+#define SECONDS_BURST_SECONDS 10
+
+// The most seconds shown in a single day.
+#define SECONDS_BUDGET_SECONDS (30 * SECONDS_BURST_SECONDS)
+
+// The version of the persisted seconds budget; increment when changing its layout.
+#define PERSIST_SECONDS_BUDGET_VERSION 1
+
+// The key of the persisted seconds budget, following the persisted contexts.
+#define PERSIST_SECONDS_BUDGET_KEY (PERSIST_CONTEXTS_KEY + 1)
+
+// The persisted seconds budget.
+typedef struct __attribute__((__packed__)) {
+  // Always PERSIST_SECONDS_BUDGET_VERSION.
+  uint8_t version;
+  
+  // The local day the budget was used in (see local_day).
+  uint16_t day;
+  
+  // The seconds shown in that day.
+  uint16_t used_seconds;
+} SecondsBudget;
+
+static SecondsBudget seconds_budget = { PERSIST_SECONDS_BUDGET_VERSION };
+
+// Whether the seconds budget changed since it was persisted.
+static bool is_seconds_budget_dirty;
+
+// When the current seconds burst ends, or 0 if there is none.
+static time_t seconds_burst_end_time;
+
+static void handle_tick(struct tm* tick_time, TimeUnits units_changed);
+
+// A number identifying the local day of the time.
+static uint16_t local_day(const struct tm *tick_time) {
+  return tick_time->tm_year * 366 + tick_time->tm_yday;
+}
+
+// The seconds left in the budget of the day.
+static int seconds_budget_left(const struct tm *tick_time) {
+  if (seconds_budget.day != local_day(tick_time)) {
+    seconds_budget.day = local_day(tick_time);
+    seconds_budget.used_seconds = 0;
+  }
+  return SECONDS_BUDGET_SECONDS - seconds_budget.used_seconds;
+}
+
+// Show the seconds of the tick time, charging them to the budget.
+static void show_seconds(const struct tm *tick_time) {
+  static char seconds_text[] = "00";
+  format_two_digits(seconds_text, tick_time->tm_sec);
+  set_text(SECONDS_TEXT, seconds_text);
+  ++seconds_budget.used_seconds;
+  is_seconds_budget_dirty = true;
+}
+
+static void write_seconds_budget() {
+  persist_write_data(PERSIST_SECONDS_BUDGET_KEY, &seconds_budget, sizeof(seconds_budget));
+  is_seconds_budget_dirty = false;
+}
+
+static void start_seconds_burst(time_t current_time) {
+  struct tm *tick_time = localtime(&current_time);
+  int budget_seconds = seconds_budget_left(tick_time);
+  if (budget_seconds <= 0) {
+    return;
+  }
+  if (!seconds_burst_end_time) {
+    tick_timer_service_subscribe(SECOND_UNIT, &handle_tick);
+    show_seconds(tick_time);
+  }
+  seconds_burst_end_time = current_time + (budget_seconds < SECONDS_BURST_SECONDS
+                                           ? budget_seconds : SECONDS_BURST_SECONDS);
+}
+
+static bool is_seconds_burst() {
+  return seconds_burst_end_time;
+}
+
+// Called by each tick during a seconds burst.
+static void update_seconds_burst(struct tm *tick_time) {
+  if (mktime(tick_time) < seconds_burst_end_time && seconds_budget_left(tick_time) > 0) {
+    show_seconds(tick_time);
+    return;
+  }
+  seconds_burst_end_time = 0;
+  set_text(SECONDS_TEXT, "");
+  tick_timer_service_subscribe(MINUTE_UNIT, &handle_tick);
+  write_seconds_budget();
+}
+
+static void init_seconds_budget() {
+  SecondsBudget record;
+  if (persist_read_data(PERSIST_SECONDS_BUDGET_KEY, &record, sizeof(record)) == sizeof(record)
+   && record.version == PERSIST_SECONDS_BUDGET_VERSION) {
+    seconds_budget = record;
+  }
+}
+
+static void deinit_seconds_budget() {
+  if (is_seconds_budget_dirty) {
+    write_seconds_budget();
+  }
+}
+
+//// Power governor.
+
+// TRICKY: Most of the time nobody looks at the watch: it lies still on a desk, or its wearer is
+// asleep. The governor then switches to a cheaper profile, which keeps the compass off and only
+// formats the time left on battery events, so plugging the charger or crossing into another style
+// still shows at once (it is kept current again when resuming). A wrist flick resumes the active profile
+// at once, even at night; movement (steps) does so only when awake, as sleepers toss and turn. Each
+// transition is logged with the battery level, so the battery log shows the drain of each profile.
+
+// The power profiles.
+typedef enum {
+  ACTIVE_PROFILE, // Someone may be looking, so everything is kept current.
+  IDLE_PROFILE, // No wrist flick or movement for a while.
+  NIGHT_PROFILE, // The Health service says the wearer is asleep (and there was no wrist flick).
+  PROFILES_COUNT
+} WhichProfile;
+
+static const char *profile_names[PROFILES_COUNT] = {
+  "active", // ACTIVE_PROFILE
+  "idle", // IDLE_PROFILE
+  "night", // NIGHT_PROFILE
+};
+
+// How long after the last wrist flick or movement to stay in the active profile.
+#define ACTIVE_PROFILE_SECONDS (30 * 60)
+
+// The current profile.
+static WhichProfile profile;
+
+// When the wrist was last flicked (or the watchface launched).
+static time_t flick_time;
+
+// When the Health service last reported movement.
+static time_t movement_time;
+
+static bool is_active_profile() {
+  return profile == ACTIVE_PROFILE;
+}
+
+static bool is_asleep() {
+#ifndef NO_HEALTH
+  return health_service_peek_current_activities() & (HealthActivitySleep | HealthActivityRestfulSleep);
+#else
+  return false;
+#endif
+}
+
+static WhichProfile governed_profile(time_t current_time) {
+  if (current_time - flick_time < ACTIVE_PROFILE_SECONDS) {
+    return ACTIVE_PROFILE;
+  }
+  if (is_asleep()) {
+    return NIGHT_PROFILE;
+  }
+  if (current_time - movement_time < ACTIVE_PROFILE_SECONDS) {
+    return ACTIVE_PROFILE;
+  }
+  return IDLE_PROFILE;
+}
+
+static void update_profile(time_t current_time) {
+  WhichProfile new_profile = governed_profile(current_time);
+  if (new_profile == ACTIVE_PROFILE) {
+    time_t active_time = flick_time > movement_time ? flick_time : movement_time;
+    schedule_deadline(PROFILE_DEADLINE, active_time + ACTIVE_PROFILE_SECONDS);
+  }
+  if (new_profile == profile) {
+    return;
+  }
+  APP_LOG(APP_LOG_LEVEL_INFO, "profile %s at %d%%", profile_names[new_profile], battery_charge_state.charge_percent);
+  profile = new_profile;
+  if (profile == ACTIVE_PROFILE) {
+    update_time_left(current_time);
+  } else {
+    schedule_deadline(TIME_LEFT_DEADLINE, 0);
+    cancel_compass();
+  }
+}
+
+static void wrist_flick(AccelAxisType axis, int32_t direction) {
+  uint32_t start_ms = clock_ms();
+  flick_time = time(NULL);
+  update_profile(flick_time);
+  start_compass();
+  start_seconds_burst(flick_time);
+  record_handler(FLICK_HANDLER, start_ms);
+}
+
+#ifndef NO_HEALTH
+
+static void health_update(HealthEventType event, void *context) {
+  uint32_t start_ms = clock_ms();
+  time_t current_time = time(NULL);
+  if (event == HealthEventMovementUpdate) {
+    movement_time = current_time;
+  }
+  update_profile(current_time);
+  record_handler(HEALTH_HANDLER, start_ms);
+}
+
+static void subscribe_health() {
+  health_service_events_subscribe(health_update, NULL);
+}
+
+static void unsubscribe_health() {
+  health_service_events_unsubscribe();
+}
+
+#else
+
+// There is no Health service to subscribe to.
+static void subscribe_health() {
+}
+
+static void unsubscribe_health() {
+}
+
+#endif
+
 //// Subscriptions.
 
+// The minute (or, during a seconds burst, second) tick handler; update_time is also called directly
+// when starting.
+static void handle_tick(struct tm* tick_time, TimeUnits units_changed) {
+  uint32_t start_ms = clock_ms();
+  if (units_changed & MINUTE_UNIT) {
+    update_time(tick_time, units_changed);
+  }
+  if (seconds_burst_end_time) {
+    // This renders a frame anyway, so show whatever is pending in it as well.
+    commit_events(true);
+    update_seconds_burst(tick_time);
+  }
+  record_handler(TICK_HANDLER, start_ms);
+}
+
 static void init_subscriptions() {
-  tick_timer_service_subscribe(MINUTE_UNIT, &update_time);
-  bluetooth_connection_service_subscribe(update_bluetooth_status);
-  compass_service_set_heading_filter(10 * (TRIG_MAX_ANGLE / 360));
-  compass_service_subscribe(&update_compass);
-  battery_state_service_subscribe(battery_update);
+  app_focus_service_subscribe_handlers((AppFocusHandlers){ .did_focus = focus_update });
+  tick_timer_service_subscribe(MINUTE_UNIT, &handle_tick);
+  bluetooth_connection_service_subscribe(queue_bluetooth_event);
+  accel_tap_service_subscribe(wrist_flick);
+  subscribe_health();
+  subscribe_layout();
+  // Launching is as good as a wrist flick.
+  flick_time = init_time;
+  update_profile(init_time);
+  start_compass();
+  battery_state_service_subscribe(queue_battery_event);
 }
 
 // Prevent blank data until the 1st event arrives, which could be long.
 // Ideally, subscribe should have immediately invoked the callback...
 static void trigger_updates_before_subscriptions() {
-  update_time(localtime(&init_time), DAY_UNIT);
-  update_bluetooth_status(bluetooth_connection_service_peek());
+  update_time(localtime(&init_time), MINUTE_UNIT);
+  update_date(init_time);
+  // If the battery was charged while we were not running, this starts a new history segment. We
+  // can't know when exactly the charger was unplugged, so now is the best guess we have.
+  update_battery_prediction(init_time);
+  is_bluetooth_connected = bluetooth_connection_service_peek();
+  update_bluetooth_status(is_bluetooth_connected);
 }
 
 static void deinit_subscriptions() {
   battery_state_service_unsubscribe();
-  compass_service_unsubscribe();
+  cancel_compass();
+  unsubscribe_layout();
+  unsubscribe_health();
+  accel_tap_service_unsubscribe();
   bluetooth_connection_service_unsubscribe();
   tick_timer_service_unsubscribe();
+  app_focus_service_unsubscribe();
+  deinit_events();
+}
+
+//// Heap footprint.
+
+#ifdef DEBUG
+
+// TRICKY: The app heap is shared by the fonts (and the large frame bitmap in BITMAP_FRAME builds),
+// the layers and everything else. To know how much room is left for new features, we log how much
+// heap each init stage takes, and whenever the most heap used at any time after that grows.
+
+// The most heap used at any time so far.
+static size_t heap_high_water;
+
+// We also log when each init stage ends, to see how long it takes until the first frame is shown.
+static bool is_launched;
+static uint32_t launch_ms;
+
+static int32_t ms_since_launch() {
+  if (!is_launched) {
+    is_launched = true;
+    launch_ms = clock_ms();
+  }
+  return clock_ms() - launch_ms;
+}
+
+static void track_heap_high_water() {
+  size_t used_bytes = heap_bytes_used();
+  if (used_bytes > heap_high_water) {
+    heap_high_water = used_bytes;
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "heap high water: %d used, %d free", (int)used_bytes, (int)heap_bytes_free());
+  }
 }
 
+static void init_stage(const char *name, void (*init_function)()) {
+  int used_bytes_before = heap_bytes_used();
+  int free_bytes_before = heap_bytes_free();
+  int32_t start_ms = ms_since_launch();
+  init_function();
+  int32_t end_ms = ms_since_launch();
+  int used_bytes_after = heap_bytes_used();
+  int free_bytes_after = heap_bytes_free();
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "%s: done at %dms, took %dms; heap used %d -> %d, free %d -> %d, takes %d",
+          name, (int)end_ms, (int)(end_ms - start_ms), used_bytes_before, used_bytes_after,
+          free_bytes_before, free_bytes_after, used_bytes_after - used_bytes_before);
+  if ((size_t)used_bytes_after > heap_high_water) {
+    heap_high_water = used_bytes_after;
+  }
+}
+
+#define INIT_STAGE(init_function) init_stage(#init_function, init_function)
+
+#else
+
+#define INIT_STAGE(init_function) init_function()
+
+#endif
+
 /// Main.
 
+// TRICKY: To show the watchface as soon as possible, init only creates what the first frame needs
+// (the frame, the time and the battery), and everything else (the bitmaps and the other fonts,
+// restoring the predictors, and the subscriptions) is done by init_rest, from a timer registered
+// once the first frame was drawn, so it runs after the frame was pushed to the display.
+
+static AppTimer *init_rest_timer;
+static bool is_first_frame_drawn;
+static bool is_rest_initialized;
+
+static void init_first_time() {
+  update_time(localtime(&init_time), MINUTE_UNIT);
+}
+
+static void init_rest(void *data) {
+  init_rest_timer = NULL;
+  if (is_rest_initialized) {
+    return;
+  }
+  is_rest_initialized = true;
+  INIT_STAGE(init_telemetry);
+  INIT_STAGE(init_image_bitmaps);
+  INIT_STAGE(init_fonts);
+  INIT_STAGE(init_predictors);
+  INIT_STAGE(init_usage_contexts);
+  INIT_STAGE(init_battery_history);
+  INIT_STAGE(init_seconds_budget);
+  INIT_STAGE(trigger_updates_before_subscriptions);
+  INIT_STAGE(init_subscriptions);
+}
+
+static void first_frame_drawn() {
+  if (is_first_frame_drawn) {
+    return;
+  }
+  is_first_frame_drawn = true;
+#ifdef DEBUG
+  APP_LOG(APP_LOG_LEVEL_DEBUG, "first frame at %dms", (int)ms_since_launch());
+#endif
+  init_rest_timer = app_timer_register(0, init_rest, NULL);
+}
+
 static void init(void) {
-  init_window();
-  init_images();
-  init_fonts();
-  init_battery_graphics();
-  init_texts();
-  init_predictors();
-  trigger_updates_before_subscriptions();
-  init_subscriptions();
+  INIT_STAGE(init_window);
+  INIT_STAGE(init_frame);
+  INIT_STAGE(init_images);
+  INIT_STAGE(init_time_font);
+  INIT_STAGE(init_battery_graphics);
+  INIT_STAGE(init_texts);
+  INIT_STAGE(init_layout);
+  INIT_STAGE(init_first_time);
 }
 
 static void deinit(void) {
-  deinit_subscriptions();
-  deinit_predictors();
+  // If we exit before init_rest ran (it runs all its stages at once), there is nothing it subscribed
+  // to or restored to undo (and writing the predictors would overwrite the persisted ones with the
+  // defaults); the bitmaps, fonts and telemetry session it creates are only released if they exist.
+  if (init_rest_timer) {
+    app_timer_cancel(init_rest_timer);
+    init_rest_timer = NULL;
+  }
+  if (is_rest_initialized) {
+    deinit_subscriptions();
+    deinit_seconds_budget();
+    deinit_battery_history();
+    deinit_usage_contexts();
+    deinit_predictors();
+  }
+  deinit_deadlines();
   deinit_texts();
   deinit_battery_graphics();
   deinit_fonts();
   deinit_images();
+  deinit_frame();
   deinit_window();
+  deinit_telemetry();
 }
 
 int main(void) {